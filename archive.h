@@ -0,0 +1,274 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+// Lossless archive of lattice snapshots: every frame holds the exact state of all sites, one bit per site in row-major
+// order of the coordinates (for every layout, see pack_state() in configuration.h), packed into 64-bit words. A frame
+// is stored as the XOR of its words with those of the previous frame, which is mostly zero bytes at low temperatures and
+// in coarsening runs, and every keyframe_interval-th frame (a keyframe) as the XOR of every word with the word before
+// it, so that it decodes on its own and uniform domains become zero bytes as well. The bytes are then run-length encoded
+// as a sequence of (number of zero bytes, number of literal bytes, literal bytes), with the counts as varints. Near the
+// critical point, a fifth of the spins change within 10 sweeps and the frames stay close to their packed size. The
+// index of the frames (offset, sweeps, keyframe) follows the frames and is written when the archive is closed; an
+// archive without index (e.g. after a crash) is read by scanning the frames. Multi-byte values are little-endian.
+//
+// file:  "ISNA" version:u16 length:u16 dimension:u8 keyframe_interval:u16 volume:u32, frames, index, trailer
+// frame: "FRM" keyframe:u8 sweeps:f64 bytes:u32, bytes of encoded words
+// index: (offset:u64 sweeps:f64 keyframe:u8) per frame
+// trailer: index_offset:u64 frames:u32 "INDX"
+
+constexpr uint16_t archive_version = 1;                                                                    // format written by snapshot_archive
+
+struct archive_entry
+{
+  uint64_t offset;                                                                                         // position of the frame in the file
+  double sweeps;                                                                                           // sweeps at which the state was taken
+  bool keyframe;                                                                                           // the frame decodes without the previous one
+};
+
+class snapshot_archive
+{
+  public:
+    snapshot_archive(std::string filename, uint16_t length, uint8_t dimension, uint32_t volume, uint16_t _keyframe_interval = 64); // constructor, creates the archive for states of volume sites
+    ~snapshot_archive();                                                                                   // destructor, writes the index
+    void append(const std::vector<uint64_t>& words, double sweeps);                                        // appends the packed state taken after the given sweeps
+    uint64_t raw_bytes;                                                                                    // size of the packed states appended
+    uint64_t stored_bytes;                                                                                 // size of the encoded frames
+  private:
+    std::ofstream file;                                                                                    // archive
+    uint16_t keyframe_interval;                                                                            // frames between keyframes
+    std::vector<uint64_t> previous;                                                                        // packed state of the previous frame
+    std::vector<uint64_t> delta;                                                                           // words to be encoded
+    std::vector<uint8_t> encoded;                                                                          // run-length encoding of delta
+    std::vector<archive_entry> index;                                                                      // frames appended
+};
+
+class snapshot_archive_reader
+{
+  public:
+    snapshot_archive_reader(std::string filename);                                                         // constructor, reads the header and the index (or scans the frames)
+    bool valid;                                                                                            // the file is an archive of a known version
+    uint16_t length;                                                                                       // length of the lattice
+    uint8_t dimension;                                                                                     // number of dimensions
+    uint32_t volume;                                                                                       // number of sites
+    std::vector<archive_entry> index;                                                                      // frames of the archive
+    bool read(size_t frame, std::vector<uint64_t>& words);                                                 // decodes the packed state of the frame, starting from the previous keyframe unless reading forward
+    static bool bit(const std::vector<uint64_t>& words, uint64_t c);                                        // returns the state of the site with row-major index c
+  private:
+    bool decode(size_t frame, std::vector<uint64_t>& out);                                                 // decodes the words of the frame into out (XOR deltas)
+    std::ifstream file;                                                                                    // archive
+    std::vector<uint64_t> current;                                                                         // packed state of the last frame decoded
+    size_t current_frame;                                                                                  // last frame decoded (index.size(): none)
+    std::vector<uint8_t> encoded;                                                                          // encoded words of a frame
+};
+
+inline void
+write_varint(std::vector<uint8_t>& out, uint64_t value)
+{
+  while(value >= 0x80){
+    out.push_back((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(value);
+}
+
+inline uint64_t
+read_varint(const uint8_t*& in, const uint8_t* end)
+{
+  uint64_t value = 0;
+  for(uint8_t shift = 0; in < end && shift < 64; shift += 7){
+    uint8_t byte = *in++;
+    value |= ((uint64_t) (byte & 0x7F)) << shift;
+    if(!(byte & 0x80)) break;
+  }
+  return value;
+}
+
+template <typename T> void
+write_value(std::ostream& out, T value)
+{
+  out.write((const char*) &value,sizeof(T));
+}
+
+template <typename T> T
+read_value(std::istream& in)
+{
+  T value = 0;
+  in.read((char*) &value,sizeof(T));
+  return value;
+}
+
+inline
+snapshot_archive::snapshot_archive(std::string filename, uint16_t length, uint8_t dimension, uint32_t volume, uint16_t _keyframe_interval) : raw_bytes(0) , stored_bytes(0) , file(filename,std::ofstream::binary | std::ofstream::trunc) , keyframe_interval(std::max<uint16_t>(_keyframe_interval,1)) , previous((volume+63)/64,0) , delta((volume+63)/64)
+{
+  file.write("ISNA",4);
+  write_value<uint16_t>(file,archive_version);
+  write_value<uint16_t>(file,length);
+  write_value<uint8_t>(file,dimension);
+  write_value<uint16_t>(file,keyframe_interval);
+  write_value<uint32_t>(file,volume);
+  if(!file) std::cout << "Cannot write the archive " << filename << "." << std::endl;
+}
+
+inline
+snapshot_archive::~snapshot_archive()
+{
+  uint64_t index_offset = file.tellp();
+  for(const archive_entry& entry : index){
+    write_value<uint64_t>(file,entry.offset);
+    write_value<double>(file,entry.sweeps);
+    write_value<uint8_t>(file,entry.keyframe);
+  }
+  write_value<uint64_t>(file,index_offset);
+  write_value<uint32_t>(file,index.size());
+  file.write("INDX",4);
+}
+
+inline void
+snapshot_archive::append(const std::vector<uint64_t>& words, double sweeps)
+{
+  bool keyframe = (index.size() % keyframe_interval == 0);
+  if(keyframe){
+    delta[0] = words[0];
+    for(size_t w = 1; w < words.size(); w++) delta[w] = words[w] ^ words[w-1];
+  }
+  else{
+    for(size_t w = 0; w < words.size(); w++) delta[w] = words[w] ^ previous[w];
+  }
+  previous = words;
+  encoded.clear();
+  const uint8_t* bytes = (const uint8_t*) delta.data();
+  size_t size = 8*delta.size();
+  size_t b = 0;
+  while(b < size){
+    size_t zeros = b;
+    while(zeros < size && bytes[zeros] == 0) zeros++;
+    // a literal run ends at two consecutive zero bytes, a single zero is cheaper to copy than to start a new run
+    size_t literals = zeros;
+    while(literals < size && (bytes[literals] != 0 || (literals+1 < size && bytes[literals+1] != 0))) literals++;
+    write_varint(encoded,zeros-b);
+    write_varint(encoded,literals-zeros);
+    encoded.insert(encoded.end(),bytes+zeros,bytes+literals);
+    b = literals;
+  }
+  index.push_back({(uint64_t) file.tellp(),sweeps,keyframe});
+  file.write("FRM",3);
+  write_value<uint8_t>(file,keyframe);
+  write_value<double>(file,sweeps);
+  write_value<uint32_t>(file,encoded.size());
+  file.write((const char*) encoded.data(),encoded.size());
+  // the frames written so far survive a crash, the reader then scans them
+  file.flush();
+  raw_bytes += 8*words.size();
+  stored_bytes += encoded.size() + 16;
+}
+
+inline
+snapshot_archive_reader::snapshot_archive_reader(std::string filename) : valid(false) , length(0) , dimension(0) , volume(0) , file(filename,std::ifstream::binary) , current_frame(0)
+{
+  char magic[4] = {0};
+  file.read(magic,4);
+  if(!file || memcmp(magic,"ISNA",4) != 0 || read_value<uint16_t>(file) != archive_version) return;
+  length = read_value<uint16_t>(file);
+  dimension = read_value<uint8_t>(file);
+  read_value<uint16_t>(file);
+  volume = read_value<uint32_t>(file);
+  uint64_t first_frame = file.tellg();
+  current.assign((volume+63)/64,0);
+  file.seekg(0,std::ios::end);
+  uint64_t size = file.tellg();
+  if(size >= first_frame + 16){
+    file.seekg(size-16);
+    uint64_t index_offset = read_value<uint64_t>(file);
+    uint32_t frames = read_value<uint32_t>(file);
+    file.read(magic,4);
+    if(file && memcmp(magic,"INDX",4) == 0 && index_offset + 17ull*frames + 16 == size){
+      file.seekg(index_offset);
+      for(uint32_t n = 0; n < frames; n++){
+        archive_entry entry;
+        entry.offset = read_value<uint64_t>(file);
+        entry.sweeps = read_value<double>(file);
+        entry.keyframe = read_value<uint8_t>(file);
+        index.push_back(entry);
+      }
+    }
+  }
+  // no index: the archive was not closed, the complete frames are found by scanning
+  if(index.empty()){
+    file.clear();
+    file.seekg(first_frame);
+    while(true){
+      archive_entry entry;
+      entry.offset = file.tellg();
+      file.read(magic,3);
+      entry.keyframe = read_value<uint8_t>(file);
+      entry.sweeps = read_value<double>(file);
+      uint32_t bytes = read_value<uint32_t>(file);
+      if(!file || memcmp(magic,"FRM",3) != 0 || entry.offset + 16 + bytes > size) break;
+      index.push_back(entry);
+      file.seekg(bytes,std::ios::cur);
+    }
+  }
+  file.clear();
+  valid = true;
+  current_frame = index.size();
+}
+
+inline bool
+snapshot_archive_reader::bit(const std::vector<uint64_t>& words, uint64_t c)
+{
+  return (words[c >> 6] >> (c & 63)) & 1;
+}
+
+inline bool
+snapshot_archive_reader::decode(size_t frame, std::vector<uint64_t>& out)
+{
+  file.seekg(index[frame].offset + 12);
+  uint32_t bytes = read_value<uint32_t>(file);
+  encoded.resize(bytes);
+  file.read((char*) encoded.data(),bytes);
+  if(!file) return false;
+  const uint8_t* in = encoded.data();
+  const uint8_t* end = in + bytes;
+  uint8_t* state = (uint8_t*) out.data();
+  size_t size = 8*out.size();
+  size_t b = 0;
+  while(in < end && b < size){
+    b += read_varint(in,end);
+    uint64_t literals = read_varint(in,end);
+    if(b + literals > size || in + literals > end) return false;
+    for(uint64_t n = 0; n < literals; n++) state[b++] ^= *in++;
+  }
+  return true;
+}
+
+inline bool
+snapshot_archive_reader::read(size_t frame, std::vector<uint64_t>& words)
+{
+  if(!valid || frame >= index.size()) return false;
+  size_t first = frame;
+  while(!index[first].keyframe && first > 0) first--;
+  // continues from the last frame decoded if that is on the way
+  if(current_frame < index.size() && current_frame >= first && current_frame <= frame) first = current_frame + 1;
+  else{
+    std::fill(current.begin(),current.end(),0);
+    if(!decode(first,current)) return false;
+    for(size_t w = 1; w < current.size(); w++) current[w] ^= current[w-1];
+    current_frame = first++;
+  }
+  for(; first <= frame; first++){
+    if(!decode(first,current)) return false;
+    current_frame = first;
+  }
+  words = current;
+  return true;
+}
+
+#endif
@@ -1,3 +1,11 @@
+#ifndef AVG_STDEV_H
+#define AVG_STDEV_H
+
+#include <vector>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+
 template <typename Container, typename T = typename std::decay<decltype(*std::begin(std::declval<Container>()))>::type> T stdev(Container && c)
 { 
     auto b = std::begin(c), e = std::end(c);
@@ -19,7 +27,7 @@ template <typename Container, typename T = typename std::decay<decltype(*std::be
     return mean;
 }
 
-double corr(const std::vector<double>& x, const std::vector<double>& y) {
+inline double corr(const std::vector<double>& x, const std::vector<double>& y) {
     const auto n    = x.size();
     const auto s_x  = std::accumulate(x.begin(), x.end(), 0.0);
     const auto s_y  = std::accumulate(y.begin(), y.end(), 0.0);
@@ -30,7 +38,7 @@ double corr(const std::vector<double>& x, const std::vector<double>& y) {
     return a;
 }
 
-double slope(const std::vector<double>& x, const std::vector<double>& y) {
+inline double slope(const std::vector<double>& x, const std::vector<double>& y) {
     const auto n    = x.size();
     const auto s_x  = std::accumulate(x.begin(), x.end(), 0.0);
     const auto s_y  = std::accumulate(y.begin(), y.end(), 0.0);
@@ -39,3 +47,20 @@ double slope(const std::vector<double>& x, const std::vector<double>& y) {
     const auto a    = (n * s_xy - s_x * s_y) / (n * s_xx - s_x * s_x);
     return a;
 }
+
+// Streaming mean and standard deviation (Welford), for samples that are too many to be kept in a list.
+struct running_stdev {
+    uint64_t n = 0;
+    double mean = 0;
+    double m2 = 0;
+    void push(double x) {
+        n++;
+        const auto delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+    }
+    double stdev() const { return (n > 1) ? std::sqrt(m2 / (n - 1)) : 0.; }
+    double error() const { return (n > 1) ? stdev() / std::sqrt((double) n) : 0.; }
+};
+
+#endif
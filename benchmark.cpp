@@ -0,0 +1,163 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <fmt/core.h>
+
+#include "layout.h"
+#include "perf_counters.h"
+
+// Compares the lattice layouts for the three access patterns of the simulation: random-site Metropolis proposals,
+// sequential sweeps and the growth of Wolff-like clusters. Every access evaluates the neighbour sum of a site, which is
+// what energy_change_upon_flip() does. The reported time is the mean time per visited site. With --perf-counters, the
+// hardware events per visited site (see perf_counters.h) are reported as well, one line per access pattern, which
+// tells whether a layout and length is bound by the instructions, the latency or the bandwidth of the memory.
+
+volatile uint64_t sink = 0;                                     // keeps the compiler from discarding the benchmark loops
+std::unique_ptr<perf_counters> hardware;                        // counts the timed loops (--perf-counters)
+
+template <typename LAYOUT>
+double random_access(std::vector<uint8_t>& spin, std::mt19937& rng, uint32_t visits)
+{
+  std::uniform_int_distribution<uint32_t> site_distribution(0,LAYOUT::volume-1);
+  uint64_t checksum = 0;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  if(hardware) hardware->start();
+  for(uint32_t n = 0; n < visits; n++){
+    uint32_t s = site_distribution(rng);
+    uint8_t sum = spin[LAYOUT::neighbour(s,0)] + spin[LAYOUT::neighbour(s,1)] + spin[LAYOUT::neighbour(s,2)] + spin[LAYOUT::neighbour(s,3)];
+    if(sum >= 2) spin[s] = !spin[s];
+    checksum += sum;
+  }
+  if(hardware) hardware->stop();
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  sink += checksum;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / (double) visits;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT>
+double sequential_access(std::vector<uint8_t>& spin, uint32_t sweeps)
+{
+  uint64_t checksum = 0;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  if(hardware) hardware->start();
+  for(uint32_t n = 0; n < sweeps; n++){
+    for(uint16_t i = 0; i < ARRAY_LEN; i++){
+      for(uint16_t j = 0; j < ARRAY_LEN; j++){
+        uint32_t s = LAYOUT::site(i,j);
+        uint8_t sum = spin[LAYOUT::neighbour(s,0)] + spin[LAYOUT::neighbour(s,1)] + spin[LAYOUT::neighbour(s,2)] + spin[LAYOUT::neighbour(s,3)];
+        if(sum >= 2) spin[s] = !spin[s];
+        checksum += sum;
+      }
+    }
+  }
+  if(hardware) hardware->stop();
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  sink += checksum;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / ((double) sweeps * LAYOUT::volume);
+}
+
+template <typename LAYOUT>
+double cluster_access(std::vector<uint8_t>& spin, std::mt19937& rng, uint32_t visits)
+{
+  std::uniform_int_distribution<uint32_t> site_distribution(0,LAYOUT::volume-1);
+  std::uniform_real_distribution<double> real_distribution(0.0,1.0);
+  const double p_add = 1. - std::exp(-2.*0.44);
+  std::vector<bool> in_cluster(LAYOUT::volume,false);
+  std::vector<uint32_t> stack;
+  std::vector<uint32_t> cluster;
+  uint32_t visited = 0;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  if(hardware) hardware->start();
+  while(visited < visits){
+    uint32_t seed = site_distribution(rng);
+    bool state = spin[seed];
+    stack.push_back(seed);
+    in_cluster[seed] = true;
+    while(!stack.empty() && visited < visits){
+      uint32_t s = stack.back();
+      stack.pop_back();
+      cluster.push_back(s);
+      visited++;
+      for(uint8_t k = 0; k < LAYOUT::coordination; k++){
+        uint32_t n = LAYOUT::neighbour(s,k);
+        if(!in_cluster[n] && spin[n] == state && real_distribution(rng) < p_add){
+          in_cluster[n] = true;
+          stack.push_back(n);
+        }
+      }
+    }
+    for(uint32_t s : stack) in_cluster[s] = false;
+    stack.clear();
+    for(uint32_t s : cluster){
+      in_cluster[s] = false;
+      spin[s] = !state;
+    }
+    cluster.clear();
+  }
+  if(hardware) hardware->stop();
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / (double) visits;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT>
+void benchmark(std::string name)
+{
+  std::mt19937 rng(12345);
+  std::bernoulli_distribution spin_distribution(0.5);
+  std::vector<uint8_t> spin(LAYOUT::volume);
+  for(uint32_t s = 0; s < LAYOUT::volume; s++) spin[s] = spin_distribution(rng);
+  uint32_t sweeps = (ARRAY_LEN < 1024)? 64 : 4;
+  if(hardware){
+    // fresh counters for every access pattern
+    auto report = [&](std::string access, double time){
+      perf_counts counts = hardware->read();
+      double visits = (double) sweeps*LAYOUT::volume;
+      std::cout << fmt::format("{:d}\t{:s}\t{:s}\t{:.3f}\t{:.2f}",ARRAY_LEN,name,access,time,counts.value[perf_instructions]/counts.value[perf_cycles]);
+      for(uint8_t event = 0; event < perf_events; event++) std::cout << fmt::format("\t{:.4f}",counts.value[event]/visits);
+      std::cout << std::endl;
+      hardware.reset(new perf_counters());
+    };
+    hardware.reset(new perf_counters());
+    report("random",random_access<LAYOUT>(spin,rng,sweeps*LAYOUT::volume));
+    report("sequential",sequential_access<ARRAY_LEN,LAYOUT>(spin,sweeps));
+    report("cluster",cluster_access<LAYOUT>(spin,rng,sweeps*LAYOUT::volume));
+    return;
+  }
+  double t_random = random_access<LAYOUT>(spin,rng,sweeps*LAYOUT::volume);
+  double t_sequential = sequential_access<ARRAY_LEN,LAYOUT>(spin,sweeps);
+  double t_cluster = cluster_access<LAYOUT>(spin,rng,sweeps*LAYOUT::volume);
+  std::cout << fmt::format("{:d}\t{:s}\t{:.3f}\t{:.3f}\t{:.3f}",ARRAY_LEN,name,t_random,t_sequential,t_cluster) << std::endl;
+}
+
+template <uint16_t ARRAY_LEN>
+void compare_layouts()
+{
+  benchmark<ARRAY_LEN,row_major<ARRAY_LEN>>("row_major");
+  benchmark<ARRAY_LEN,morton<ARRAY_LEN>>("morton");
+}
+
+int main(int argc, char *argv[]){
+  if(argc > 1 && std::string(argv[1]) == "--perf-counters"){
+    hardware.reset(new perf_counters());
+    if(!hardware->error.empty()) std::cout << "Counters " << (hardware->active ? "partly unavailable" : "unavailable, timing only") << ": " << hardware->error << "." << std::endl;
+    if(!hardware->active) hardware.reset();
+  }
+  else if(argc > 1){
+    std::cout << "Usage:\n\t" << argv[0] << " [--perf-counters]" << std::endl;
+    return 0;
+  }
+  if(hardware){
+    std::cout << "L\tlayout\taccess\ttime[ns]\tIPC";
+    for(uint8_t event = 0; event < perf_events; event++) std::cout << "\t" << perf_counters::name(event);
+    std::cout << std::endl;
+  }
+  else std::cout << "L\tlayout\trandom[ns]\tsequential[ns]\tcluster[ns]" << std::endl;
+  compare_layouts<256>();
+  compare_layouts<1024>();
+  compare_layouts<2048>();
+  compare_layouts<4096>();
+}
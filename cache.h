@@ -0,0 +1,75 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fmt/format.h>
+
+// Content-addressed store of run results, shared by all campaigns that use the same directory: the results of a run
+// are kept in a file named after the 64-bit FNV-1a hash of its key (which must describe everything that determines the
+// run) and the code version. The file holds the key on the first line, so that a hash collision is detected as a
+// miss, and the results on the second one. Files are written under a temporary name and renamed, hence concurrent
+// processes and crashes never leave a partial entry behind.
+
+class results_cache
+{
+  public:
+    results_cache(std::string _directory, std::string _version);                                                             // constructor, creates the directory if necessary
+    bool find(const std::string& key, std::vector<double>& values) const;                                                    // returns whether the results of the run are cached, and the results
+    void store(const std::string& key, const std::vector<double>& values) const;                                             // caches the results of the run
+    std::string path(const std::string& key) const;                                                                          // returns the file of the run
+  private:
+    std::string directory;                                                                                                   // directory of the entries
+    std::string version;                                                                                                     // code version, part of every key
+};
+
+inline
+results_cache::results_cache(std::string _directory, std::string _version) : directory(_directory) , version(_version)
+{
+  mkdir(directory.c_str(),0755);
+}
+
+inline std::string
+results_cache::path(const std::string& key) const
+{
+  uint64_t hash = 14695981039346656037ull;
+  for(char c : key + "\t" + version){
+    hash ^= (uint8_t) c;
+    hash *= 1099511628211ull;
+  }
+  return fmt::format("{}/{:016x}.dat",directory,hash);
+}
+
+inline bool
+results_cache::find(const std::string& key, std::vector<double>& values) const
+{
+  std::ifstream in(path(key));
+  std::string stored_key;
+  std::string line;
+  if(!std::getline(in,stored_key) || stored_key != key + "\t" + version || !std::getline(in,line)) return false;
+  values.clear();
+  for(size_t field = 0; field != std::string::npos; field = line.find('\t',field+1)) values.push_back(strtod(line.c_str()+field+(field > 0),nullptr));
+  return true;
+}
+
+inline void
+results_cache::store(const std::string& key, const std::vector<double>& values) const
+{
+  std::string file = path(key);
+  std::string temporary = fmt::format("{}.{}.{:x}",file,getpid(),std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::ofstream out(temporary);
+  out << key << "\t" << version << "\n";
+  for(size_t k = 0; k < values.size(); k++) out << (k > 0 ? "\t" : "") << fmt::format("{}",values[k]);
+  out << "\n";
+  out.close();
+  if(!out || std::rename(temporary.c_str(),file.c_str()) != 0) std::remove(temporary.c_str());
+}
+
+#endif
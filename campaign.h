@@ -0,0 +1,122 @@
+#ifndef CAMPAIGN_H
+#define CAMPAIGN_H
+
+#include <cstdint>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <math.h>
+#include "jobs.h"
+#include "grid.h"
+
+// Finite-size-scaling campaign: one job per system size and temperature, each with an estimated cost (e.g. the number
+// of sweeps times the measured time per sweep). The cost differs by orders of magnitude between the sizes, hence the
+// jobs are started longest first (LPT scheduling), which keeps the makespan within 4/3 of the optimum instead of
+// leaving the largest size to run alone at the end. The jobs report their averages to the grid, from which the Binder
+// crossings of consecutive sizes and the scaling collapse are tabulated once all jobs are done.
+
+class scaling_campaign
+{
+  public:
+    scaling_campaign(std::vector<uint16_t> _lengths);                                                                        // constructor for the given system lengths (in increasing order)
+    void add(uint8_t size, float T, double cost, std::function<void()> job);                                                 // adds the job of the size with index size at T
+    void run(uint16_t threads = std::thread::hardware_concurrency());                                                       // executes all jobs, longest first, and blocks until they are done
+    void write_crossings(std::ostream& out);                                                                                 // writes the Binder crossings of consecutive sizes
+    float critical_temperature();                                                                                            // returns the crossing of the two largest sizes closest to the maximum of x of the largest size (the maximum if they do not cross)
+    void write_collapse(std::ostream& out, double nu, double gamma_over_nu);                                                 // writes x and U_L against the scaling variable L^(1/nu)*(T-T_c)/T_c
+    temperature_grid grid;                                                                                                   // averages reported by the jobs
+  private:
+    struct job
+    {
+      double cost;                                                                                                           // estimated cost in seconds
+      uint8_t size;                                                                                                          // index of the system size
+      float T;                                                                                                               // temperature
+      std::function<void()> run;                                                                                             // simulation
+    };
+    std::vector<uint16_t> lengths;                                                                                           // system lengths
+    std::vector<job> jobs;                                                                                                   // jobs not executed yet
+};
+
+inline
+scaling_campaign::scaling_campaign(std::vector<uint16_t> _lengths) : grid(_lengths.size(),0) , lengths(_lengths)
+{
+}
+
+inline void
+scaling_campaign::add(uint8_t size, float T, double cost, std::function<void()> job)
+{
+  jobs.push_back({cost,size,T,std::move(job)});
+}
+
+inline void
+scaling_campaign::run(uint16_t threads)
+{
+  std::stable_sort(jobs.begin(),jobs.end(),[](const job& a, const job& b){ return a.cost > b.cost; });
+  // the makespan of the schedule if the estimates are exact: every job goes to the thread that becomes idle first
+  std::priority_queue<double,std::vector<double>,std::greater<double>> idle(std::greater<double>(),std::vector<double>(std::max<uint16_t>(threads,1),0));
+  double total = 0;
+  for(const job& j : jobs){
+    double start = idle.top();
+    idle.pop();
+    idle.push(start + j.cost);
+    total += j.cost;
+  }
+  double makespan = 0;
+  while(!idle.empty()){
+    makespan = idle.top();
+    idle.pop();
+  }
+  std::cout << "Campaign of " << jobs.size() << " jobs: estimated " << total << " seconds of compute, makespan " << makespan << " seconds on " << threads << " threads." << std::endl;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  {
+    job_pool pool(threads);
+    for(job& j : jobs) pool.submit(std::move(j.run));
+    pool.wait();
+  }
+  jobs.clear();
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  std::cout << "Campaign took " << std::chrono::duration_cast<std::chrono::seconds> (end - begin).count() << " seconds." << std::endl;
+}
+
+inline void
+scaling_campaign::write_crossings(std::ostream& out)
+{
+  out << "L1\tL2\tT_cross\n";
+  for(uint8_t size = 0; size + 1u < lengths.size(); size++){
+    for(float T : grid.crossings(size,size+1)) out << lengths[size] << "\t" << lengths[size+1] << "\t" << T << std::endl;
+  }
+}
+
+inline float
+scaling_campaign::critical_temperature()
+{
+  uint8_t largest = lengths.size() - 1;
+  auto curve = grid.curve(largest);
+  auto peak = std::max_element(curve.begin(),curve.end(),[](const auto& a, const auto& b){ return a.second.susceptibility < b.second.susceptibility; });
+  if(peak == curve.end()) return 0;
+  // noise in the ordered and disordered phases adds spurious crossings, the one of the transition is next to the peak
+  if(largest > 0){
+    std::vector<float> crossing = grid.crossings(largest-1,largest);
+    if(!crossing.empty()) return *std::min_element(crossing.begin(),crossing.end(),[&](float a, float b){ return std::abs(a - peak->first) < std::abs(b - peak->first); });
+  }
+  return peak->first;
+}
+
+inline void
+scaling_campaign::write_collapse(std::ostream& out, double nu, double gamma_over_nu)
+{
+  float T_c = critical_temperature();
+  std::cout << "Scaling collapse around T_c = " << T_c << " with nu = " << nu << ", gamma/nu = " << gamma_over_nu << "." << std::endl;
+  out << "L\tT\tscaled_t\tscaled_x\tU_L\n";
+  for(uint8_t size = 0; size < lengths.size(); size++){
+    double length = lengths[size];
+    for(const auto& p : grid.curve(size)){
+      out << lengths[size] << "\t" << p.first << "\t" << pow(length,1./nu)*(p.first-T_c)/T_c << "\t" << p.second.susceptibility*pow(length,-gamma_over_nu) << "\t" << p.second.binder_cumulant << std::endl;
+    }
+  }
+}
+
+#endif
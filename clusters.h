@@ -0,0 +1,187 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "avg_stdev.h"
+#include "jobs.h"
+
+// Geometric cluster (domain) statistics: the maximal sets of nearest-neighbour sites with equal spins are labelled by a
+// Hoshen-Kopelman pass with union-find, and their size distribution n_s (clusters of size s per site), the fraction of
+// the sites in the largest cluster and the mean size of the other clusters are averaged over the snapshots. The lattice
+// is cut into one stack of slabs (see layout.h) per thread; every thread labels its tile on its own, joining only sites
+// of the tile, hence the trees of different tiles are disjoint. The forward bonds between the last slab of every tile
+// and the first slab of the next one, including the periodic wrap from the last slab to slab 0, are merged afterwards.
+// The labelling is meant to run in a stage of the snapshot pipeline (see snapshots.h), off the sweeping thread, which
+// labels the first tile itself and hands the others to a pool of workers that persists from one snapshot to the next.
+
+struct cluster_summary
+{
+  std::vector<double> size_distribution;                                                                                     // n_s, s = 0..volume: number of clusters of size s per site
+  running_stdev largest_fraction;                                                                                            // fraction of the sites in the largest cluster
+  running_stdev clusters_per_site;                                                                                           // number of clusters per site
+  running_stdev mean_cluster_size;                                                                                           // sum s^2 n_s / sum s n_s without the largest cluster
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT>
+class cluster_statistics
+{
+  public:
+    cluster_statistics(uint16_t _threads = 1);                                                                               // constructor for labelling on _threads threads
+    template <typename SPIN> void evaluate(SPIN spin);                                                                       // labels the snapshot spin(s) in {-1,0,1} (0: vacant) and adds its statistics
+    cluster_summary result();                                                                                                // returns the averages over the snapshots so far
+    void reset();                                                                                                            // discards the snapshots so far
+    void label(const std::vector<int8_t>& spin, std::vector<uint32_t>& root);                                                // sets root[s] to the smallest site of the cluster of s (volume for vacant sites)
+  private:
+    uint32_t find(uint32_t s);                                                                                               // returns the root of the tree of s, halving the path
+    void unite(uint32_t s, uint32_t t);                                                                                      // joins the trees of s and t under the smaller root
+    void label_tile(const std::vector<int8_t>& spin, uint16_t begin, uint16_t end);                                          // labels the slabs [begin,end), joining forward bonds within them only
+    uint16_t threads;                                                                                                        // number of tiles labelled concurrently
+    std::unique_ptr<job_pool> workers;                                                                                       // persistent workers for all tiles but the first one (nullptr: not started yet)
+    std::vector<int8_t> signs;                                                                                               // spins of the snapshot being labelled
+    std::vector<uint32_t> parent;                                                                                            // union-find forest over the sites
+    std::vector<uint32_t> root;                                                                                              // root of every site of the last snapshot
+    std::vector<uint32_t> size;                                                                                              // size of the cluster of every root
+    std::vector<uint64_t> histogram;                                                                                         // number of clusters of every size, summed over the snapshots
+    cluster_summary summary;                                                                                                 // averages over the snapshots (size_distribution is filled by result())
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT>
+cluster_statistics<ARRAY_LEN,LAYOUT>::cluster_statistics(uint16_t _threads) : threads(std::clamp<uint16_t>(_threads,1,ARRAY_LEN)) , signs(LAYOUT::volume) , parent(LAYOUT::volume) , root(LAYOUT::volume) , size(LAYOUT::volume) , histogram(LAYOUT::volume+1,0)
+{
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+cluster_statistics<ARRAY_LEN,LAYOUT>::reset()
+{
+  std::fill(histogram.begin(),histogram.end(),0);
+  summary = cluster_summary();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> cluster_summary
+cluster_statistics<ARRAY_LEN,LAYOUT>::result()
+{
+  cluster_summary averages = summary;
+  averages.size_distribution.assign(histogram.size(),0);
+  for(size_t s = 0; s < histogram.size() && summary.largest_fraction.n > 0; s++) averages.size_distribution[s] = histogram[s]/((double) summary.largest_fraction.n*LAYOUT::volume);
+  return averages;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> uint32_t
+cluster_statistics<ARRAY_LEN,LAYOUT>::find(uint32_t s)
+{
+  while(parent[s] != s){
+    parent[s] = parent[parent[s]];
+    s = parent[s];
+  }
+  return s;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+cluster_statistics<ARRAY_LEN,LAYOUT>::unite(uint32_t s, uint32_t t)
+{
+  s = find(s);
+  t = find(t);
+  if(s < t) parent[t] = s;
+  else parent[s] = t;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+cluster_statistics<ARRAY_LEN,LAYOUT>::label_tile(const std::vector<int8_t>& spin, uint16_t begin, uint16_t end)
+{
+  for(uint16_t i = begin; i < end; i++){
+    for(uint32_t line = 0; line < LAYOUT::lines; line++){
+      for(uint16_t j = 0; j < ARRAY_LEN; j++){
+        uint32_t s = LAYOUT::slab_site(i,line,j);
+        parent[s] = s;
+      }
+    }
+  }
+  for(uint16_t i = begin; i < end; i++){
+    for(uint32_t line = 0; line < LAYOUT::lines; line++){
+      for(uint16_t j = 0; j < ARRAY_LEN; j++){
+        uint32_t s = LAYOUT::slab_site(i,line,j);
+        if(spin[s] == 0) continue;
+        // the forward neighbours along the other axes are in the same slab (periodically)
+        for(uint8_t a = (i + 1 < end) ? 0 : 1; a < LAYOUT::dimension; a++){
+          uint32_t t = LAYOUT::neighbour(s,2*a+1);
+          if(spin[t] == spin[s]) unite(s,t);
+        }
+      }
+    }
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+cluster_statistics<ARRAY_LEN,LAYOUT>::label(const std::vector<int8_t>& spin, std::vector<uint32_t>& root)
+{
+  uint16_t tile_rows = ARRAY_LEN/threads;
+  auto tile_begin = [&](uint16_t k){ return (uint16_t) (k*tile_rows); };
+  auto tile_end = [&](uint16_t k){ return (k == threads-1) ? ARRAY_LEN : (uint16_t) ((k+1)*tile_rows); };
+  auto flatten = [&](uint16_t k){
+    // read-only, the trees are final
+    for(uint16_t i = tile_begin(k); i < tile_end(k); i++){
+      for(uint32_t line = 0; line < LAYOUT::lines; line++){
+        for(uint16_t j = 0; j < ARRAY_LEN; j++){
+          uint32_t s = LAYOUT::slab_site(i,line,j);
+          uint32_t r = s;
+          while(parent[r] != r) r = parent[r];
+          root[s] = (spin[s] == 0) ? LAYOUT::volume : r;
+        }
+      }
+    }
+  };
+  auto in_parallel = [&](auto phase){
+    if(threads == 1){
+      phase(0);
+      return;
+    }
+    if(!workers) workers.reset(new job_pool(threads-1,"clusters"));
+    for(uint16_t k = 1; k < threads; k++) workers->submit([&phase,k]{ phase(k); });
+    phase(0);
+    workers->wait();
+  };
+  in_parallel([&](uint16_t k){ label_tile(spin,tile_begin(k),tile_end(k)); });
+  for(uint16_t k = 0; k < threads; k++){
+    uint16_t i = tile_end(k)-1;
+    for(uint32_t line = 0; line < LAYOUT::lines; line++){
+      for(uint16_t j = 0; j < ARRAY_LEN; j++){
+        uint32_t s = LAYOUT::slab_site(i,line,j);
+        uint32_t t = LAYOUT::neighbour(s,1);
+        if(spin[s] != 0 && spin[t] == spin[s]) unite(s,t);
+      }
+    }
+  }
+  in_parallel(flatten);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> template <typename SPIN> void
+cluster_statistics<ARRAY_LEN,LAYOUT>::evaluate(SPIN spin)
+{
+  for(uint32_t s = 0; s < LAYOUT::volume; s++) signs[s] = spin(s);
+  label(signs,root);
+  std::fill(size.begin(),size.end(),0);
+  uint32_t occupied = 0;
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    if(root[s] == LAYOUT::volume) continue;
+    size[root[s]]++;
+    occupied++;
+  }
+  uint32_t clusters = 0;
+  uint32_t largest = 0;
+  double sum_squares = 0;
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    if(size[s] == 0) continue;
+    histogram[size[s]]++;
+    clusters++;
+    largest = std::max(largest,size[s]);
+    sum_squares += (double) size[s]*size[s];
+  }
+  summary.largest_fraction.push(largest/(double) LAYOUT::volume);
+  summary.clusters_per_site.push(clusters/(double) LAYOUT::volume);
+  summary.mean_cluster_size.push((occupied > largest) ? (sum_squares - (double) largest*largest)/(occupied - largest) : 0.);
+}
+
+#endif
@@ -0,0 +1,22 @@
+# Writes OUTPUT (code_version.h) with CODE_VERSION = the git revision followed by a hash of all sources in SOURCE_DIR,
+# so that every edit, including the #define switches of main.cpp, changes the version that keys the results cache. Run
+# at every build; the header is only rewritten when the version changes, so that unchanged code is not recompiled.
+file(GLOB sources ${SOURCE_DIR}/*.h ${SOURCE_DIR}/*.cpp)
+list(REMOVE_ITEM sources ${OUTPUT})
+list(SORT sources)
+set(hashes "")
+foreach(source ${sources})
+  file(SHA256 ${source} hash)
+  set(hashes "${hashes}${hash}")
+endforeach()
+string(SHA256 digest "${hashes}")
+string(SUBSTRING ${digest} 0 16 digest)
+execute_process(COMMAND git describe --always WORKING_DIRECTORY ${SOURCE_DIR} OUTPUT_VARIABLE revision OUTPUT_STRIP_TRAILING_WHITESPACE ERROR_QUIET)
+set(content "#define CODE_VERSION \"${revision}+${digest}\"\n")
+set(previous "")
+if(EXISTS ${OUTPUT})
+  file(READ ${OUTPUT} previous)
+endif()
+if(NOT "${content}" STREQUAL "${previous}")
+  file(WRITE ${OUTPUT} "${content}")
+endif()
@@ -7,140 +7,384 @@
 #define D(x) do{}while(0)
 #endif
 
-#ifdef DISPLAY
-#define Display(x) (x)
-#else
-#define Display(x) do{}while(0)
-#endif
-
 #include <string>
 #include <fmt/core.h>
 #include <fstream>
 #include <random>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <math.h>
 #include <opencv2/opencv.hpp>
+#include "layout.h"
+#include "fields.h"
+#include "archive.h"
 
-template <uint16_t ARRAY_LEN>
+template <uint16_t ARRAY_LEN, typename LAYOUT = row_major<ARRAY_LEN>, typename FIELDS = computed_fields<LAYOUT>>
 class configuration
 {
   public:
-    configuration(std::string _filename, float bias);           // constructor
+    static constexpr uint32_t volume = LAYOUT::volume;          // number of sites
+    configuration(std::string _filename, float bias);           // constructor, an empty filename disables the video and the datafile
+    ~configuration();                                           // destructor, closes the video
     bool get_spin(uint16_t i, uint16_t j);                      // returns the state of the spin at position (i,j)
-    void gray2bgr();                                            // converts the grayscale image img to the blue-green-red image bgr
-    void imshow();                                              // shows the blue-green-red image bgr in the window created in the constructor
-    void destroyWindow();                                       // closes the window created in the constructor
-    void vidwrite();                                            // appends the frame bgr to the videofile
+    bool get_spin(uint32_t s);                                  // returns the state of the spin at the site s of the layout
+    int8_t get_sign(uint32_t s);                                // returns the spin at the site s as +-1 (0 if the site is vacant)
+    int8_t sign_of(const bool* state, uint32_t s);              // returns the spin at the site s of state (e.g. a snapshot) as +-1 (0 if the site is vacant)
+    void set_rendering(uint16_t resolution, uint16_t top = 0, uint16_t left = 0, uint16_t size = ARRAY_LEN); // renders the square of the given size at (top,left), box-filtered down to at most resolution pixels per side (0: all)
+    void set_video_pipe(std::string command);                   // writes raw BGR24 frames to the command ({width}, {height} and {name} are replaced) instead of the videofile
+    void render(const bool* state, cv::Mat& frame);             // draws the (first plane of the) state in gray into the blue-green-red frame, above a black information bar for frames >= 200 pixels wide
+    void vidwrite(const cv::Mat& frame);                        // appends the frame to the videofile (opened with the size of the first frame)
     void vidrelease();                                          // saves and closes the videofile
+    void pack_state(const bool* state, std::vector<uint64_t>& words); // packs the state into one bit per site in row-major order of the coordinates (see archive.h)
+    void archive_write(const bool* state, double sweeps);       // appends the exact state to the archive (created with the first state)
+    void restore(const std::vector<uint64_t>& words);           // replaces the current state by a packed state, e.g. read from an archive
     float get_magnetization();                                  // returns the magnetization of the current state
     float get_energy();                                         // returns the energy of the current state
+    float magnetization_of(const bool* state);                  // returns the magnetization of state (e.g. a snapshot)
+    float energy_of(const bool* state);                         // returns the energy of state (e.g. a snapshot)
+    double get_fourier_squared();                               // returns |m(k)|^2 at the smallest nonzero wave vectors, averaged over the axes
+    uint32_t get_occupied();                                    // returns the number of occupied sites (the volume without vacancies)
+    void set_disorder(double antiferro_fraction, double vacancy_fraction); // draws a new realization of +-J bonds and vacancies (requires disordered_fields)
   protected:
     uint16_t idx(int32_t x);                                    // index helper function for periodic boundary conditions
     void invert_spin(uint16_t i, uint16_t j);                   // inverts the spin at (i,j)
+    void invert_spin(uint32_t s, bool track = true);            // inverts the spin at the site s of the layout (track: update the Fourier modes, not thread-safe)
+    void compute_modes();                                       // recomputes the Fourier modes from scratch
+    void update_modes(uint32_t s);                              // updates the Fourier modes after the spin at s has been inverted
+    uint8_t neighbour_sum(uint32_t s);                          // returns the number of up spins among the neighbours of the site s
+    uint8_t local_state(uint32_t s);                            // returns the packed spin and neighbour sum of the site s (see fields.h)
+    const bool* spins();                                        // returns the state of all sites in the order of the layout, e.g. to be copied into a snapshot
     void set_spin(uint16_t i, uint16_t j, bool newspin);        // sets the spin at (i,j)
     std::mt19937 rng;                                           // 32-bit Mersenne Twister pseudo-random generator
     std::uniform_int_distribution<uint16_t> int_distribution;   // converts the 32-bit random numbers to integer range
+    std::uniform_int_distribution<uint32_t> site_distribution;  // converts the 32-bit random numbers to site indices
     std::uniform_real_distribution<double> real_distribution;   // converts the 32-bit random numbers to real interval
-    cv::Mat bgr;                                                // blue-green-red image used to display the spinsystem and information
     std::ofstream datafile;                                     // datafile used to log the evolution of the configuration
+    bool recording;                                             // the configuration is recorded and logged
   private:
     const uint16_t length = ARRAY_LEN;                          // length of the system
-    bool spin[ARRAY_LEN][ARRAY_LEN];                            // state of the spinsystem
-    uint8_t spinimg[ARRAY_LEN][ARRAY_LEN];                      // uint8_t representation of the spinsystem for the grayscale image img
-    cv::Mat img;                                                // grayscale image based directly on the above array spinimg
+    std::unique_ptr<bool[]> spin;                               // state of the spinsystem, ordered by the layout
+    FIELDS fields;                                              // computes or caches the local states of the sites
     std::string videofilename;                                  // name of the datafile
     std::string datafilename;                                   // name of the videofile
     cv::VideoWriter video;                                      // tool to append frames to a video
+    std::string pipe_command;                                   // external encoder reading raw frames (empty: cv::VideoWriter)
+    FILE* video_pipe;                                           // standard input of the external encoder
+    uint16_t crop_top;                                          // first row of the rendered square
+    uint16_t crop_left;                                         // first column of the rendered square
+    uint16_t crop_size;                                         // length of the rendered square
+    uint16_t box;                                               // length of the square of sites averaged into one pixel
+    std::vector<uint32_t> box_sums;                             // up spins of every pixel of the row of pixels being rendered
+    std::string archivefilename;                                // name of the snapshot archive
+    std::unique_ptr<snapshot_archive> archive;                  // exact states appended by archive_write()
+    std::vector<uint64_t> packed;                               // packed state being archived
+    std::vector<double> twiddle_cos;                            // cos(2 pi x / ARRAY_LEN) for every coordinate x
+    std::vector<double> twiddle_sin;                            // sin(2 pi x / ARRAY_LEN) for every coordinate x
+    double mode_re[LAYOUT::dimension];                          // real part of the sum of the spins times exp(i 2 pi x_a / ARRAY_LEN) along every axis a
+    double mode_im[LAYOUT::dimension];                          // imaginary part of the same
+    uint32_t mode_sites;                                        // number of sites entering the modes
 };
 
-template <uint16_t ARRAY_LEN>
-configuration<ARRAY_LEN>::configuration(std::string _filename, float bias) : rng(std::random_device{}()) , int_distribution{0,ARRAY_LEN-1} , real_distribution{0.0,1.0} , datafile(_filename+".dat",std::ofstream::out) , img(ARRAY_LEN,ARRAY_LEN,CV_8U,spinimg) , video(_filename+".mkv",cv::VideoWriter::fourcc('X','2','6','4'),30, cv::Size(ARRAY_LEN,ARRAY_LEN+(ARRAY_LEN >= 200)*ARRAY_LEN/15))
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS>
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::configuration(std::string _filename, float bias) : rng(std::random_device{}()) , int_distribution{0,ARRAY_LEN-1} , site_distribution{0,LAYOUT::volume-1} , real_distribution{0.0,1.0} , recording(!_filename.empty()) , spin(new bool[LAYOUT::volume]) , video_pipe(nullptr) , crop_top(0) , crop_left(0) , crop_size(ARRAY_LEN) , box(1) , box_sums(ARRAY_LEN)
 {
   videofilename = _filename+".mkv";
   datafilename = _filename+".dat";
+  archivefilename = _filename+".isa";
+  if(recording) datafile.open(datafilename,std::ofstream::out);
   std::uniform_real_distribution<float> biased_distribution(0.0,1.+1./bias);
-  for(uint16_t i = 0; i < ARRAY_LEN; i++)
+  for(uint32_t s = 0; s < LAYOUT::volume; s++)
   {
-    for(uint16_t j = 0; j < ARRAY_LEN; j++)
-    {
-      this->spin[i][j] = (int) biased_distribution(rng);
-      this->spinimg[i][j] = this->spin[i][j]*255;
-    }
+    this->spin[s] = (int) biased_distribution(rng);
+  }
+  fields.init(spin.get());
+  for(uint16_t x = 0; x < ARRAY_LEN; x++){
+    twiddle_cos.push_back(cos(2*M_PI*x/ARRAY_LEN));
+    twiddle_sin.push_back(sin(2*M_PI*x/ARRAY_LEN));
   }
-  Display(cv::namedWindow(videofilename,cv::WINDOW_NORMAL));
-  cv::cvtColor(img,bgr,cv::COLOR_GRAY2BGR);
+  compute_modes();
 }
 
-template <uint16_t ARRAY_LEN> void
-configuration<ARRAY_LEN>::gray2bgr()
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS>
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::~configuration()
 {
-  cv::cvtColor(img,bgr,cv::COLOR_GRAY2BGR);
-  if(ARRAY_LEN >= 200) bgr.push_back(cv::Mat(cv::Size(ARRAY_LEN,ARRAY_LEN/15), CV_8UC3, cv::Scalar(0,0,0)));
+  vidrelease();
 }
 
-template <uint16_t ARRAY_LEN> void
-configuration<ARRAY_LEN>::imshow()
+// The square must lie within the lattice (no periodic wrap), so that the sites of a row of a box are consecutive in the
+// row-major layout and their sum vectorizes.
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::set_rendering(uint16_t resolution, uint16_t top, uint16_t left, uint16_t size)
 {
-  Display(cv::imshow(videofilename,bgr));
+  crop_size = std::clamp<uint16_t>(size,1,ARRAY_LEN);
+  crop_top = std::min<uint16_t>(top,ARRAY_LEN-crop_size);
+  crop_left = std::min<uint16_t>(left,ARRAY_LEN-crop_size);
+  box = (resolution == 0) ? 1 : (crop_size+resolution-1)/resolution;
 }
 
-template <uint16_t ARRAY_LEN> void
-configuration<ARRAY_LEN>::destroyWindow()
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::set_video_pipe(std::string command)
 {
-  Display(cv::destroyWindow(videofilename));
+  pipe_command = command;
 }
 
-template <uint16_t ARRAY_LEN> void
-configuration<ARRAY_LEN>::vidwrite()
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::render(const bool* state, cv::Mat& frame)
 {
-  video.write(bgr);
+  uint16_t pixels = crop_size/box;
+  uint16_t bar = (pixels >= 200)*pixels/15;
+  frame.create(pixels+bar,pixels,CV_8UC3);
+  for(uint16_t r = 0; r < pixels; r++){
+    std::fill(box_sums.begin(),box_sums.begin()+pixels,0);
+    for(uint16_t i = crop_top+r*box; i < crop_top+(r+1)*box; i++){
+      for(uint16_t c = 0; c < pixels; c++){
+        uint32_t sum = 0;
+        uint16_t j = crop_left+c*box;
+        for(uint16_t b = 0; b < box; b++) sum += state[LAYOUT::site(i,j+b)];
+        box_sums[c] += sum;
+      }
+    }
+    cv::Vec3b* pixel = frame.ptr<cv::Vec3b>(r);
+    for(uint16_t c = 0; c < pixels; c++){
+      uint8_t gray = box_sums[c]*255/((uint32_t) box*box);
+      pixel[c] = cv::Vec3b(gray,gray,gray);
+    }
+  }
+  if(bar > 0) frame.rowRange(pixels,frame.rows).setTo(cv::Scalar(0,0,0));
 }
 
-template <uint16_t ARRAY_LEN> void
-configuration<ARRAY_LEN>::vidrelease()
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::vidwrite(const cv::Mat& frame)
+{
+  if(!recording) return;
+  if(!pipe_command.empty()){
+    if(video_pipe == nullptr) video_pipe = popen(fmt::format(fmt::runtime(pipe_command),fmt::arg("width",frame.cols),fmt::arg("height",frame.rows),fmt::arg("name",videofilename)).c_str(),"w");
+    if(video_pipe == nullptr) return;
+    for(int i = 0; i < frame.rows; i++) fwrite(frame.ptr<uchar>(i),3,frame.cols,video_pipe);
+    return;
+  }
+  if(!video.isOpened()) video.open(videofilename,cv::VideoWriter::fourcc('X','2','6','4'),30,cv::Size(frame.cols,frame.rows));
+  video.write(frame);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::vidrelease()
 {
   video.release();
+  if(video_pipe != nullptr) pclose(video_pipe);
+  video_pipe = nullptr;
 }
 
-template <uint16_t ARRAY_LEN> bool
-configuration<ARRAY_LEN>::get_spin(uint16_t i, uint16_t j){
-  return spin[i][j];
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::pack_state(const bool* state, std::vector<uint64_t>& words)
+{
+  words.assign((LAYOUT::volume+63)/64,0);
+  uint64_t word = 0;
+  uint32_t c = 0;
+  for(uint16_t i = 0; i < ARRAY_LEN; i++){
+    for(uint32_t line = 0; line < LAYOUT::lines; line++){
+      for(uint16_t j = 0; j < ARRAY_LEN; j++, c++){
+        word |= ((uint64_t) state[LAYOUT::slab_site(i,line,j)]) << (c & 63);
+        if((c & 63) == 63){
+          words[c >> 6] = word;
+          word = 0;
+        }
+      }
+    }
+  }
+  if(c & 63) words[c >> 6] = word;
 }
 
-template <uint16_t ARRAY_LEN> float
-configuration<ARRAY_LEN>::get_magnetization(){
-  uint64_t sum = 0;
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::archive_write(const bool* state, double sweeps)
+{
+  if(!recording) return;
+  if(archive == nullptr) archive.reset(new snapshot_archive(archivefilename,ARRAY_LEN,LAYOUT::dimension,LAYOUT::volume));
+  pack_state(state,packed);
+  archive->append(packed,sweeps);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::restore(const std::vector<uint64_t>& words)
+{
+  uint32_t c = 0;
   for(uint16_t i = 0; i < ARRAY_LEN; i++){
-    for(uint16_t j = 0; j < ARRAY_LEN; j++){
-      sum += spin[i][j];
+    for(uint32_t line = 0; line < LAYOUT::lines; line++){
+      for(uint16_t j = 0; j < ARRAY_LEN; j++, c++) spin[LAYOUT::slab_site(i,line,j)] = snapshot_archive_reader::bit(words,c);
+    }
+  }
+  fields.init(spin.get());
+  compute_modes();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> bool
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::get_spin(uint16_t i, uint16_t j){
+  return spin[LAYOUT::site(i,j)];
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> bool
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::get_spin(uint32_t s){
+  return spin[s];
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> int8_t
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::get_sign(uint32_t s){
+  return sign_of(spin.get(),s);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> int8_t
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::sign_of(const bool* state, uint32_t s){
+  if constexpr (FIELDS::disordered){
+    if(!fields.occupied(s)) return 0;
+  }
+  return state[s] ? 1 : -1;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> const bool*
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::spins(){
+  return spin.get();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> float
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::get_magnetization(){
+  return magnetization_of(spin.get());
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> float
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::get_energy(){
+  return energy_of(spin.get());
+}
+
+// The bonds and vacancies are only read, hence snapshots may be evaluated concurrently with the sweeps.
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> float
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::magnetization_of(const bool* state){
+  uint64_t sum = 0;
+  if constexpr (FIELDS::disordered){
+    // per occupied site
+    uint64_t sites = 0;
+    for(uint32_t s = 0; s < LAYOUT::volume; s++){
+      bool occupied = fields.occupied(s);
+      sum += occupied && state[s];
+      sites += occupied;
     }
+    return (sites == 0) ? 0. : -1.+2.*((float) sum)/sites;
+  }
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    sum += state[s];
   }
-  return -1.+2.*((float) sum)/(((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN));
+  return -1.+2.*((float) sum)/LAYOUT::volume;
 }
 
-template <uint16_t ARRAY_LEN> float
-configuration<ARRAY_LEN>::get_energy(){
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> float
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::energy_of(const bool* state){
   int64_t sum = 0;
-  for(uint16_t i = 0; i < ARRAY_LEN; i++){
-    for(uint16_t j = 0; j < ARRAY_LEN; j++){
-        sum += (this->get_spin(i,j)-!this->get_spin(i,j))*(this->get_spin(this->idx(i+1),j)-!this->get_spin(this->idx(i+1),j)+this->get_spin(i,this->idx(j+1))-!this->get_spin(i,this->idx(j+1)));
+  if constexpr (FIELDS::disordered){
+    // per occupied site
+    uint64_t sites = 0;
+    for(uint32_t s = 0; s < LAYOUT::volume; s++){
+      sites += fields.occupied(s);
+      for(uint8_t k = 1; k < LAYOUT::coordination; k += 2){
+        uint32_t forward = LAYOUT::neighbour(s,k);
+        sum += fields.bond(s,k)*(state[s]-!state[s])*(state[forward]-!state[forward]);
+      }
+    }
+    return (sites == 0) ? 0. : -((float) sum)/sites;
+  }
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    for(uint8_t k = 1; k < LAYOUT::coordination; k += 2){
+      uint32_t forward = LAYOUT::neighbour(s,k);
+      sum += (state[s]-!state[s])*(state[forward]-!state[forward]);
     }
   }
-  return -((float) sum)/(((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN));
+  return -((float) sum)/LAYOUT::volume;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> double
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::get_fourier_squared(){
+  double sum = 0;
+  for(uint8_t a = 0; a < LAYOUT::dimension; a++) sum += mode_re[a]*mode_re[a] + mode_im[a]*mode_im[a];
+  return (mode_sites == 0) ? 0. : sum/LAYOUT::dimension/((double) mode_sites*mode_sites);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> uint32_t
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::get_occupied(){
+  return mode_sites;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::compute_modes(){
+  mode_sites = 0;
+  for(uint8_t a = 0; a < LAYOUT::dimension; a++) mode_re[a] = mode_im[a] = 0;
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    if constexpr (FIELDS::disordered){
+      if(!fields.occupied(s)) continue;
+    }
+    mode_sites++;
+    double sigma = spin[s] ? 1 : -1;
+    for(uint8_t a = 0; a < LAYOUT::dimension; a++){
+      uint16_t x = LAYOUT::coordinate(s,a);
+      mode_re[a] += sigma*twiddle_cos[x];
+      mode_im[a] += sigma*twiddle_sin[x];
+    }
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::update_modes(uint32_t s){
+  if constexpr (FIELDS::disordered){
+    if(!fields.occupied(s)) return;
+  }
+  // the spin has changed by +-2, the modes change by +-2 exp(i 2 pi x_a / ARRAY_LEN)
+  double change = spin[s] ? 2 : -2;
+  for(uint8_t a = 0; a < LAYOUT::dimension; a++){
+    uint16_t x = LAYOUT::coordinate(s,a);
+    mode_re[a] += change*twiddle_cos[x];
+    mode_im[a] += change*twiddle_sin[x];
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::set_disorder(double antiferro_fraction, double vacancy_fraction){
+  static_assert(FIELDS::disordered, "quenched disorder requires the disordered_fields policy");
+  fields.quench(rng,antiferro_fraction,vacancy_fraction);
+  compute_modes();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::set_spin(uint16_t i, uint16_t j, bool newspin){
+  uint32_t s = LAYOUT::site(i,j);
+  if(spin[s] == newspin) return;
+  spin[s] = newspin;
+  fields.flip(s,newspin);
+  update_modes(s);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::invert_spin(uint16_t i, uint16_t j){
+  invert_spin(LAYOUT::site(i,j));
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::invert_spin(uint32_t s, bool track){
+  spin[s] = !spin[s];
+  fields.flip(s,spin[s]);
+  if(track) update_modes(s);
 }
 
-template <uint16_t ARRAY_LEN> void
-configuration<ARRAY_LEN>::set_spin(uint16_t i, uint16_t j, bool newspin){
-  spin[i][j] = newspin;
-  img.at<uchar>(i,j) = 255;
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> uint8_t
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::neighbour_sum(uint32_t s){
+  return fields.local_state(spin.get(),s) & sum_mask;
 }
 
-template <uint16_t ARRAY_LEN> void
-configuration<ARRAY_LEN>::invert_spin(uint16_t i, uint16_t j){
-  spin[i][j] = !spin[i][j];
-  spinimg[i][j] = spin[i][j]*255;
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> uint8_t
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::local_state(uint32_t s){
+  return fields.local_state(spin.get(),s);
 }
 
-template <uint16_t ARRAY_LEN> uint16_t
-configuration<ARRAY_LEN>::idx(int32_t x)
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> uint16_t
+configuration<ARRAY_LEN,LAYOUT,FIELDS>::idx(int32_t x)
 {
   return (ARRAY_LEN + x % ARRAY_LEN) % ARRAY_LEN;
 }
@@ -0,0 +1,90 @@
+#ifndef CORRELATION_H
+#define CORRELATION_H
+
+#include <cstdint>
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include "fft.h"
+
+// Spin-spin correlation function G(r) = <s_x s_{x+r e_a}> for r = 0..ARRAY_LEN/2, averaged over all sites, axes and
+// snapshots. By the Wiener-Khinchin theorem, the periodic autocorrelation of every line of sites along an axis is the
+// inverse transform of the power spectrum of the line, so that a snapshot costs O(volume * dimension * log ARRAY_LEN).
+// Unless ARRAY_LEN is a power of two, the lines are zero-padded to a power of two of at least twice their length, which
+// yields the linear autocorrelation c(r), and the periodic one is c(r) + c(ARRAY_LEN - r). A snapshot is nevertheless
+// meant to be evaluated by a stage of the snapshot pipeline (see snapshots.h) rather than by the sweeping thread.
+
+template <uint16_t ARRAY_LEN, typename LAYOUT>
+class pair_correlation
+{
+  public:
+    pair_correlation();                                                                                                      // constructor
+    template <typename SPIN> void evaluate(SPIN spin);                                                                       // adds the snapshot spin(s) in {-1,0,1}
+    std::vector<double> result();                                                                                            // returns G(r), averaged over the snapshots so far
+    void reset();                                                                                                            // discards the snapshots so far
+    uint32_t snapshots;                                                                                                      // number of snapshots evaluated
+  private:
+    std::vector<double> sum;                                                                                                 // sum of G(r) over the snapshots
+    std::vector<double> g;                                                                                                   // G(r) of the current snapshot
+    static constexpr uint32_t padded_length();                                                                               // returns the length of the transforms
+    radix2_fft fft;                                                                                                          // transform of one line
+    std::vector<std::complex<double>> line;                                                                                  // spins of the current line, zero-padded, and their transforms
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> constexpr uint32_t
+pair_correlation<ARRAY_LEN,LAYOUT>::padded_length()
+{
+  uint32_t n = 1;
+  while(n < ARRAY_LEN) n *= 2;
+  return (n == ARRAY_LEN) ? n : 2*n;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT>
+pair_correlation<ARRAY_LEN,LAYOUT>::pair_correlation() : snapshots(0) , sum(ARRAY_LEN/2+1,0) , g(ARRAY_LEN/2+1) , fft(padded_length()) , line(padded_length())
+{
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> std::vector<double>
+pair_correlation<ARRAY_LEN,LAYOUT>::result()
+{
+  std::vector<double> mean(sum.size(),0);
+  for(size_t r = 0; r < sum.size() && snapshots > 0; r++) mean[r] = sum[r]/snapshots;
+  return mean;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+pair_correlation<ARRAY_LEN,LAYOUT>::reset()
+{
+  std::fill(sum.begin(),sum.end(),0);
+  snapshots = 0;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> template <typename SPIN> void
+pair_correlation<ARRAY_LEN,LAYOUT>::evaluate(SPIN spin)
+{
+  std::fill(g.begin(),g.end(),0);
+  for(uint8_t a = 0; a < LAYOUT::dimension; a++){
+    for(uint32_t s = 0; s < LAYOUT::volume; s++){
+      // every line along the axis a starts at coordinate 0
+      if(LAYOUT::coordinate(s,a) != 0) continue;
+      std::fill(line.begin(),line.end(),0);
+      uint32_t t = s;
+      for(uint16_t x = 0; x < ARRAY_LEN; x++){
+        line[x] = spin(t);
+        t = LAYOUT::neighbour(t,2*a+1);
+      }
+      fft.transform(line);
+      for(std::complex<double>& mode : line) mode = std::norm(mode);
+      fft.transform(line,true);
+      for(uint16_t r = 0; r < g.size(); r++){
+        double c = line[r].real();
+        if(padded_length() != ARRAY_LEN && r > 0) c += line[ARRAY_LEN-r].real();
+        g[r] += c/padded_length();
+      }
+    }
+  }
+  for(size_t r = 0; r < g.size(); r++) sum[r] += g[r]/(LAYOUT::dimension*(double) LAYOUT::volume);
+  snapshots++;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef COUPLINGS_H
+#define COUPLINGS_H
+
+#include <cstdint>
+#include "fields.h"
+
+// Couplings of the Hamiltonian H = -J_x sum s_i s_j (horizontal bonds) - J_y sum s_i s_j (vertical bonds) - h sum s_i.
+// Anisotropic couplings are restricted to two dimensions, J = 1 along all axes otherwise.
+// The template tags state at compile time whether a field and anisotropic couplings are present at all; the engines
+// drop the corresponding terms if they are not, so that the default zero-field, isotropic case (J_x = J_y = 1, h = 0)
+// runs the same code as before. The energy change of a flip is tabulated per acceptance index: the local state of the
+// site (see fields.h) and, for anisotropic couplings, additionally the sum of the two vertical neighbours,
+// index = 3*state + vertical sum.
+
+template <bool FIELD, bool ANISOTROPIC>
+struct couplings
+{
+  static constexpr bool field = FIELD;                                          // a uniform field h is present
+  static constexpr bool anisotropic = ANISOTROPIC;                              // J_x and J_y may differ
+  static constexpr uint8_t states = ANISOTROPIC ? 6 << spin_bit : 2 << spin_bit; // number of acceptance indices
+  float energy_change(uint8_t index, uint8_t coordination, bool disordered = false) const; // returns the energy change upon flipping a spin with the given acceptance index (disordered: see disordered_fields)
+  float j_x = 1;                                                                // coupling along the rows (between (i,j) and (i,j+1))
+  float j_y = 1;                                                                // coupling along the columns (between (i,j) and (i+1,j))
+  float h = 0;                                                                  // uniform external field
+};
+
+template <bool FIELD, bool ANISOTROPIC> float
+couplings<FIELD,ANISOTROPIC>::energy_change(uint8_t index, uint8_t coordination, bool disordered) const
+{
+  uint8_t state = ANISOTROPIC ? index/3 : index;
+  float spin = -1 + 2 * (state >> spin_bit);
+  float local_field;
+  if constexpr (ANISOTROPIC){
+    uint8_t vertical = index % 3;
+    uint8_t horizontal = (state & sum_mask) - vertical;
+    local_field = j_y * (-2 + 2 * vertical) + j_x * (-2 + 2 * horizontal);
+  }
+  else{
+    local_field = disordered ? (state & sum_mask) - coordination : -coordination + 2 * (state & sum_mask);
+  }
+  if constexpr (FIELD) local_field += h;
+  return 2 * spin * local_field;
+}
+
+typedef couplings<false,false> zero_field;                                      // J_x = J_y = 1, h = 0
+typedef couplings<true,false> uniform_field;                                    // J_x = J_y = 1, arbitrary h
+typedef couplings<false,true> anisotropic_couplings;                            // arbitrary J_x and J_y, h = 0
+typedef couplings<true,true> anisotropic_field;                                 // arbitrary J_x, J_y and h
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef DISORDER_H
+#define DISORDER_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "avg_stdev.h"
+#include "shutdown.h"
+
+// Disorder average over independent realizations of the quenched disorder (see disordered_fields). Every realization
+// is a small engine without window, video and datafile, constructed, equilibrated and measured by one worker thread;
+// the workers take the next realization from a shared counter, so that the cores stay busy regardless of the
+// equilibration time of the individual samples. The thermal averages of every sample enter streaming statistics, which
+// provide the disorder averages and their sample-to-sample fluctuations.
+
+template <typename ENGINE>
+class disorder_average
+{
+  public:
+    disorder_average(float _beta, double _antiferro_fraction, double _vacancy_fraction);                                     // constructor
+    void set_couplings(float _j_x, float _j_y, float _h = 0);                                                                // sets the couplings and the field of every sample (see metropolis::set_couplings)
+    void run(uint32_t samples, uint16_t threads, uint32_t mincycles = 1000, uint32_t cycles = 2000, uint32_t eval_cycles = 1); // simulates the given number of realizations on the given number of threads
+    running_stdev magnetization;                                                                                             // average abolute value of the magnetization per spin
+    running_stdev magnetization_squared;                                                                                     // average square of the magnetization per spin
+    running_stdev magnetization_fourth;                                                                                      // average fourth power of the magnetization per spin
+    running_stdev energy;                                                                                                    // average energy per spin
+    running_stdev energy_squared;                                                                                            // the square of the energy per spin
+    running_stdev fourier_squared;                                                                                           // average |m(k)|^2 at the smallest nonzero wave vectors
+    running_stdev susceptibility;                                                                                            // susceptibility of the samples
+    running_stdev heat_capacity;                                                                                             // heat capacity of the samples
+    running_stdev binder_cumulant;                                                                                           // Binder cumulant of the samples
+    running_stdev correlation_length;                                                                                        // second-moment correlation length of the samples
+  private:
+    void work(uint32_t samples, uint32_t mincycles, uint32_t cycles, uint32_t eval_cycles);                                  // simulates realizations until all samples are taken
+    float beta;                                                                                                              // beta (-> temperature)
+    double antiferro_fraction;                                                                                               // probability of an antiferromagnetic bond
+    double vacancy_fraction;                                                                                                 // probability of a vacant site
+    float j_x;                                                                                                               // horizontal coupling of the samples
+    float j_y;                                                                                                               // vertical coupling of the samples
+    float h;                                                                                                                 // external field of the samples
+    std::atomic<uint32_t> next_sample;                                                                                       // number of realizations taken by the workers
+    std::mutex statistics_mutex;                                                                                             // serializes the updates of the statistics
+};
+
+template <typename ENGINE>
+disorder_average<ENGINE>::disorder_average(float _beta, double _antiferro_fraction, double _vacancy_fraction) : next_sample(0)
+{
+  beta = _beta;
+  antiferro_fraction = _antiferro_fraction;
+  vacancy_fraction = _vacancy_fraction;
+  j_x = 1;
+  j_y = 1;
+  h = 0;
+}
+
+template <typename ENGINE> void
+disorder_average<ENGINE>::set_couplings(float _j_x, float _j_y, float _h)
+{
+  j_x = _j_x;
+  j_y = _j_y;
+  h = _h;
+}
+
+template <typename ENGINE> void
+disorder_average<ENGINE>::work(uint32_t samples, uint32_t mincycles, uint32_t cycles, uint32_t eval_cycles)
+{
+  while(!shutdown_requested() && next_sample++ < samples){
+    ENGINE sample("",beta,1);
+    sample.set_disorder(antiferro_fraction,vacancy_fraction);
+    sample.set_couplings(j_x,j_y,h);
+    // all cores are busy with samples, the measurements are taken between the sweeps
+    sample.set_snapshot_buffers(0);
+    double m = sample.run(mincycles,cycles,eval_cycles);
+    if(sample.interrupted) break;
+    double m2 = sample.mean_magnetization_squared;
+    double m4 = sample.mean_magnetization_fourth;
+    double e = sample.mean_energy;
+    double e2 = sample.mean_energy_squared;
+    double f2 = sample.mean_fourier_squared;
+    double xi = sample.correlation_length;
+    // m and e are per occupied site, so are the fluctuations
+    double sites = sample.get_occupied();
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    magnetization.push(m);
+    magnetization_squared.push(m2);
+    magnetization_fourth.push(m4);
+    energy.push(e);
+    energy_squared.push(e2);
+    fourier_squared.push(f2);
+    susceptibility.push((m2-m*m)*beta*sites);
+    heat_capacity.push((e2-e*e)*beta*beta*sites);
+    binder_cumulant.push(1-m4/(3.*m2*m2));
+    correlation_length.push(xi);
+  }
+}
+
+template <typename ENGINE> void
+disorder_average<ENGINE>::run(uint32_t samples, uint16_t threads, uint32_t mincycles, uint32_t cycles, uint32_t eval_cycles)
+{
+  next_sample = 0;
+  std::vector<std::thread> workers;
+  for(uint16_t n = 1; n < threads; n++) workers.emplace_back(&disorder_average<ENGINE>::work,this,samples,mincycles,cycles,eval_cycles);
+  work(samples,mincycles,cycles,eval_cycles);
+  for(std::thread& worker : workers) worker.join();
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <cstdint>
+#include <vector>
+#include <complex>
+#include <cmath>
+
+// Iterative radix-2 fast Fourier transform of a fixed power-of-two size, in place, with the twiddle factors and the
+// bit-reversal permutation tabulated once. The inverse transform is not normalized (divide by the size).
+
+class radix2_fft
+{
+  public:
+    radix2_fft(uint32_t _size);                                                                  // constructor, _size must be a power of two
+    void transform(std::vector<std::complex<double>>& x, bool inverse = false);                  // replaces x (of length size) by its (inverse) transform
+    uint32_t size;                                                                               // number of points
+  private:
+    std::vector<uint32_t> reversed;                                                              // bit-reversed index of every point
+    std::vector<std::complex<double>> twiddle;                                                   // exp(-2 pi i k/size), k = 0..size/2-1
+};
+
+inline
+radix2_fft::radix2_fft(uint32_t _size) : size(_size) , reversed(_size) , twiddle(_size/2)
+{
+  uint8_t bits = 0;
+  while((1u << bits) < size) bits++;
+  for(uint32_t k = 0; k < size; k++){
+    uint32_t r = 0;
+    for(uint8_t b = 0; b < bits; b++) r |= ((k >> b) & 1) << (bits - 1 - b);
+    reversed[k] = r;
+  }
+  for(uint32_t k = 0; k < size/2; k++) twiddle[k] = std::polar(1.,-2.*M_PI*k/size);
+}
+
+inline void
+radix2_fft::transform(std::vector<std::complex<double>>& x, bool inverse)
+{
+  for(uint32_t k = 0; k < size; k++){
+    if(k < reversed[k]) std::swap(x[k],x[reversed[k]]);
+  }
+  for(uint32_t half = 1; half < size; half *= 2){
+    uint32_t stride = size/(2*half);
+    for(uint32_t begin = 0; begin < size; begin += 2*half){
+      for(uint32_t k = 0; k < half; k++){
+        // written out, since std::complex multiplies with checks for infinities and NaN
+        double re = twiddle[k*stride].real();
+        double im = inverse ? -twiddle[k*stride].imag() : twiddle[k*stride].imag();
+        const std::complex<double>& y = x[begin+k+half];
+        std::complex<double> odd(re*y.real() - im*y.imag(),re*y.imag() + im*y.real());
+        x[begin+k+half] = x[begin+k] - odd;
+        x[begin+k] += odd;
+      }
+    }
+  }
+}
+
+#endif
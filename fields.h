@@ -0,0 +1,166 @@
+#ifndef FIELDS_H
+#define FIELDS_H
+
+#include <cstdint>
+#include <vector>
+#include <random>
+#include "layout.h"
+
+// A fields policy provides the local state of a site: the number of up spins among its neighbours in the lower four
+// bits and the spin itself in bit 4 (up to seven dimensions). The energy change upon flipping and the class of a site
+// only depend on this state.
+
+constexpr uint8_t spin_bit = 4;                                                         // position of the spin in the local state
+constexpr uint8_t sum_mask = (1 << spin_bit) - 1;                                       // bits of the neighbour sum in the local state
+
+template <typename LAYOUT>
+struct computed_fields
+{
+  static constexpr bool cached = false;                                                 // the local states are recomputed on every access
+  static constexpr bool disordered = false;                                             // all bonds are ferromagnetic and all sites occupied
+  void init(const bool* spin);                                                          // prepares the policy for the given spins
+  uint8_t local_state(const bool* spin, uint32_t s) const;                              // returns the local state of the site s
+  void flip(uint32_t s, bool newspin);                                                  // to be called after the spin at s has been set to newspin
+};
+
+template <typename LAYOUT> void
+computed_fields<LAYOUT>::init(const bool*)
+{
+}
+
+template <typename LAYOUT> uint8_t
+computed_fields<LAYOUT>::local_state(const bool* spin, uint32_t s) const
+{
+  static_assert(LAYOUT::coordination <= sum_mask, "the neighbour sum does not fit into the local state");
+  return (spin[s] << spin_bit) | stencil_sum<LAYOUT>(spin,s);
+}
+
+template <typename LAYOUT> void
+computed_fields<LAYOUT>::flip(uint32_t, bool)
+{
+}
+
+// Keeps the packed local state of every site in one byte, so that it is a single load instead of coordination+1 loads
+// from scattered addresses. Only accepted flips pay for the update of the site and its neighbours. The neighbours of a
+// site are updated without synchronization, hence flips must not happen concurrently near the same site.
+template <typename LAYOUT>
+struct cached_fields
+{
+  static constexpr bool cached = true;                                                  // the local states are kept up to date on every flip
+  static constexpr bool disordered = false;                                             // all bonds are ferromagnetic and all sites occupied
+  void init(const bool* spin);                                                          // computes the local states of all sites
+  uint8_t local_state(const bool* spin, uint32_t s) const;                              // returns the local state of the site s
+  void flip(uint32_t s, bool newspin);                                                  // to be called after the spin at s has been set to newspin
+  private:
+    std::vector<uint8_t> state;                                                         // packed local state of every site
+};
+
+template <typename LAYOUT> void
+cached_fields<LAYOUT>::init(const bool* spin)
+{
+  computed_fields<LAYOUT> computed;
+  state.resize(LAYOUT::volume);
+  for(uint32_t s = 0; s < LAYOUT::volume; s++) state[s] = computed.local_state(spin,s);
+}
+
+template <typename LAYOUT> uint8_t
+cached_fields<LAYOUT>::local_state(const bool*, uint32_t s) const
+{
+  return state[s];
+}
+
+template <typename LAYOUT> void
+cached_fields<LAYOUT>::flip(uint32_t s, bool newspin)
+{
+  state[s] ^= 1 << spin_bit;
+  for(uint8_t k = 0; k < LAYOUT::coordination; k++) state[LAYOUT::neighbour(s,k)] += newspin ? 1 : -1;
+}
+
+// Quenched disorder: random +-J bonds and site dilution. The sign of the bonds of a site is packed into one byte (bit k
+// set if the bond to neighbour k is antiferromagnetic), the bonds to vacant neighbours into another one, and the
+// occupation of the sites into a bit mask. The neighbour sum of the local state is the local field plus the coordination,
+// i.e. twice the number of occupied neighbours whose spin is aligned with the sign of their bond plus the number of
+// vacant neighbours. Vacant sites carry a spin without bonds, whose flips do not change the energy; it is excluded from
+// the magnetization.
+template <typename LAYOUT>
+struct disordered_fields
+{
+  static_assert(2 * LAYOUT::coordination <= sum_mask, "the local field does not fit into the local state");
+  static constexpr bool cached = false;                                                 // the local states are recomputed on every access
+  static constexpr bool disordered = true;                                              // the neighbour sum is the local field plus the coordination
+  void init(const bool* spin);                                                          // prepares a clean realization (all bonds ferromagnetic, all sites occupied) unless quenched before
+  void quench(std::mt19937& rng, double antiferro_fraction, double vacancy_fraction);  // draws a new realization of the disorder
+  uint8_t local_state(const bool* spin, uint32_t s) const;                              // returns the local state of the site s
+  void flip(uint32_t s, bool newspin);                                                  // to be called after the spin at s has been set to newspin
+  bool occupied(uint32_t s) const;                                                      // returns whether the site s is occupied
+  int8_t bond(uint32_t s, uint8_t k) const;                                             // returns the coupling between the site s and its k-th neighbour (-1, 0 or 1)
+  private:
+    std::vector<uint8_t> antiferro;                                                     // bit k: the bond to neighbour k is antiferromagnetic
+    std::vector<uint8_t> vacant;                                                        // bit k: neighbour k is vacant
+    std::vector<uint64_t> occupation;                                                   // bit s % 64 of word s / 64: the site s is occupied
+};
+
+template <typename LAYOUT> void
+disordered_fields<LAYOUT>::init(const bool*)
+{
+  if(!occupation.empty()) return;
+  antiferro.assign(LAYOUT::volume,0);
+  vacant.assign(LAYOUT::volume,0);
+  occupation.assign((LAYOUT::volume + 63) / 64,~0ull);
+}
+
+template <typename LAYOUT> void
+disordered_fields<LAYOUT>::quench(std::mt19937& rng, double antiferro_fraction, double vacancy_fraction)
+{
+  std::bernoulli_distribution antiferro_distribution(antiferro_fraction);
+  std::bernoulli_distribution vacancy_distribution(vacancy_fraction);
+  antiferro.assign(LAYOUT::volume,0);
+  vacant.assign(LAYOUT::volume,0);
+  occupation.assign((LAYOUT::volume + 63) / 64,0);
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    if(!vacancy_distribution(rng)) occupation[s / 64] |= 1ull << (s % 64);
+  }
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    // the forward bond 2a+1 of s is the backward bond 2a of its neighbour
+    for(uint8_t k = 1; k < LAYOUT::coordination; k += 2){
+      uint32_t n = LAYOUT::neighbour(s,k);
+      if(antiferro_distribution(rng)){
+        antiferro[s] |= 1 << k;
+        antiferro[n] |= 1 << (k - 1);
+      }
+    }
+    // a vacant site has no bonds at all
+    for(uint8_t k = 0; k < LAYOUT::coordination; k++){
+      if(!occupied(s) || !occupied(LAYOUT::neighbour(s,k))) vacant[s] |= 1 << k;
+    }
+  }
+}
+
+template <typename LAYOUT> uint8_t
+disordered_fields<LAYOUT>::local_state(const bool* spin, uint32_t s) const
+{
+  uint8_t sum = 0;
+  for(uint8_t k = 0; k < LAYOUT::coordination; k++){
+    sum += ((vacant[s] >> k) & 1) ? 1 : 2 * (spin[LAYOUT::neighbour(s,k)] ^ ((antiferro[s] >> k) & 1));
+  }
+  return (spin[s] << spin_bit) | sum;
+}
+
+template <typename LAYOUT> void
+disordered_fields<LAYOUT>::flip(uint32_t, bool)
+{
+}
+
+template <typename LAYOUT> bool
+disordered_fields<LAYOUT>::occupied(uint32_t s) const
+{
+  return (occupation[s / 64] >> (s % 64)) & 1;
+}
+
+template <typename LAYOUT> int8_t
+disordered_fields<LAYOUT>::bond(uint32_t s, uint8_t k) const
+{
+  return ((vacant[s] >> k) & 1) ? 0 : ((antiferro[s] >> k) & 1) ? -1 : 1;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+
+// Adaptive temperature grid: starting from a coarse grid, new temperatures are only placed where they resolve the
+// transition, i.e. in the intervals next to the maxima of the susceptibility and the heat capacity of every system size
+// and in the intervals where the Binder cumulants of two system sizes cross. An interval is bisected as long as it is
+// wider than the resolution, so that the grid converges to the peaks and crossings at a cost logarithmic in the
+// resolution instead of linear. Far from T_c, the Binder cumulants of all sizes approach 0 (above) or 2/3 (below),
+// so that their difference is only noise; a sign change therefore only counts as a crossing if the difference changes
+// by more than the combined error bars across the interval.
+
+class temperature_grid
+{
+  public:
+    struct point
+    {
+      double susceptibility;                                                                                                 // susceptibility
+      double heat_capacity;                                                                                                  // heat capacity
+      double binder_cumulant;                                                                                                // Binder cumulant
+      double binder_error;                                                                                                   // statistical error of the Binder cumulant (0: unknown)
+    };
+    temperature_grid(uint8_t _sizes, float _resolution);                                                                     // constructor for the given number of system sizes
+    void add(uint8_t size, float T, double susceptibility, double heat_capacity, double binder_cumulant, double binder_error = 0); // records the averages of one size at T (thread-safe)
+    std::vector<float> refine();                                                                                             // returns the temperatures to simulate next, empty once the resolution is reached
+    std::vector<std::pair<float,point>> curve(uint8_t size);                                                                 // returns the averages of one size in increasing order of T
+    std::vector<float> crossings(uint8_t a, uint8_t b);                                                                      // returns the temperatures where the Binder cumulants of two sizes cross (linearly interpolated)
+  private:
+    uint8_t sizes;                                                                                                           // number of system sizes
+    float resolution;                                                                                                        // target width of the intervals around the peaks and crossings
+    std::map<float,std::map<uint8_t,point>> points;                                                                          // averages per temperature and size
+    std::mutex mutex;                                                                                                        // protects points
+};
+
+inline
+temperature_grid::temperature_grid(uint8_t _sizes, float _resolution) : sizes(_sizes) , resolution(_resolution)
+{
+}
+
+inline void
+temperature_grid::add(uint8_t size, float T, double susceptibility, double heat_capacity, double binder_cumulant, double binder_error)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  points[T][size] = {susceptibility,heat_capacity,binder_cumulant,binder_error};
+}
+
+inline std::vector<float>
+temperature_grid::refine()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<float> T;
+  std::vector<std::map<uint8_t,point>> values;
+  for(const auto& p : points){
+    if(p.second.size() < sizes) continue;
+    T.push_back(p.first);
+    values.push_back(p.second);
+  }
+  std::set<float> next;
+  auto bisect = [&](size_t i){
+    if(i + 1 < T.size() && T[i+1] - T[i] > resolution) next.insert((T[i] + T[i+1])/2);
+  };
+  auto around_maximum = [&](double point::* observable, uint8_t size){
+    size_t best = 0;
+    for(size_t i = 1; i < T.size(); i++){
+      if(values[i][size].*observable > values[best][size].*observable) best = i;
+    }
+    if(best > 0) bisect(best - 1);
+    bisect(best);
+  };
+  for(uint8_t size = 0; size < sizes; size++){
+    around_maximum(&point::susceptibility,size);
+    around_maximum(&point::heat_capacity,size);
+  }
+  for(uint8_t a = 0; a < sizes; a++){
+    for(uint8_t b = a + 1; b < sizes; b++){
+      for(size_t i = 0; i + 1 < T.size(); i++){
+        double before = values[i][a].binder_cumulant - values[i][b].binder_cumulant;
+        double after = values[i+1][a].binder_cumulant - values[i+1][b].binder_cumulant;
+        double error = std::sqrt(std::pow(values[i][a].binder_error,2) + std::pow(values[i][b].binder_error,2) + std::pow(values[i+1][a].binder_error,2) + std::pow(values[i+1][b].binder_error,2));
+        if(before * after <= 0 && std::abs(after - before) > error) bisect(i);
+      }
+    }
+  }
+  return std::vector<float>(next.begin(),next.end());
+}
+
+inline std::vector<std::pair<float,temperature_grid::point>>
+temperature_grid::curve(uint8_t size)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<std::pair<float,point>> values;
+  for(const auto& p : points){
+    auto value = p.second.find(size);
+    if(value != p.second.end()) values.emplace_back(p.first,value->second);
+  }
+  return values;
+}
+
+inline std::vector<float>
+temperature_grid::crossings(uint8_t a, uint8_t b)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<float> T;
+  std::vector<double> difference;
+  for(const auto& p : points){
+    if(!p.second.count(a) || !p.second.count(b)) continue;
+    T.push_back(p.first);
+    difference.push_back(p.second.at(a).binder_cumulant - p.second.at(b).binder_cumulant);
+  }
+  std::vector<float> crossing;
+  for(size_t i = 0; i + 1 < T.size(); i++){
+    if(difference[i] == 0) crossing.push_back(T[i]);
+    else if(difference[i] * difference[i+1] < 0) crossing.push_back(T[i] + (T[i+1] - T[i]) * difference[i] / (difference[i] - difference[i+1]));
+  }
+  return crossing;
+}
+
+#endif
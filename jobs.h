@@ -0,0 +1,95 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include "metrics.h"
+
+// Fixed pool of worker threads that execute the submitted jobs in the order of submission. Jobs must not throw. The
+// queue depth and the busy time of every worker are exported while a metrics exporter runs (see metrics.h).
+class job_pool
+{
+  public:
+    job_pool(uint16_t threads = std::thread::hardware_concurrency(), std::string _role = "job");                             // constructor, starts the workers, named _role in the metrics
+    ~job_pool();                                                                                                             // destructor, finishes all submitted jobs and stops the workers
+    void submit(std::function<void()> job);                                                                                  // appends a job to the queue
+    void wait();                                                                                                             // blocks until all submitted jobs are finished
+  private:
+    void work();                                                                                                             // executes jobs until the pool is stopped
+    std::vector<std::thread> workers;                                                                                        // worker threads
+    std::queue<std::function<void()>> jobs;                                                                                  // jobs not started yet
+    std::mutex mutex;                                                                                                        // protects jobs, running and stopping
+    std::condition_variable available;                                                                                       // signals new jobs or stopping to the workers
+    std::condition_variable finished;                                                                                        // signals finished jobs to wait()
+    uint32_t running;                                                                                                        // number of jobs being executed
+    bool stopping;                                                                                                           // the workers stop once the queue is empty
+    std::string role;                                                                                                        // name of the workers in the metrics
+};
+
+inline
+job_pool::job_pool(uint16_t threads, std::string _role) : running(0) , stopping(false) , role(_role)
+{
+  for(uint16_t n = 0; n < std::max<uint16_t>(threads,1); n++) workers.emplace_back(&job_pool::work,this);
+}
+
+inline
+job_pool::~job_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  available.notify_all();
+  for(std::thread& worker : workers) worker.join();
+}
+
+inline void
+job_pool::submit(std::function<void()> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push(std::move(job));
+    metrics_jobs_queued++;
+  }
+  available.notify_one();
+}
+
+inline void
+job_pool::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock,[this]{ return jobs.empty() && running == 0; });
+}
+
+inline void
+job_pool::work()
+{
+  metrics_thread activity(role);
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true){
+    available.wait(lock,[this]{ return stopping || !jobs.empty(); });
+    if(jobs.empty()) return;
+    std::function<void()> job = std::move(jobs.front());
+    jobs.pop();
+    running++;
+    metrics_jobs_queued--;
+    metrics_jobs_running++;
+    lock.unlock();
+    activity.busy();
+    job();
+    activity.idle();
+    lock.lock();
+    running--;
+    metrics_jobs_running--;
+    finished.notify_all();
+  }
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fmt/format.h>
+
+// Append-only journal of completed jobs: one line per job, the key of the job followed by its results, separated by
+// tabs. A line is written with a single append and synced to disk before the job counts as done, hence a crash leaves at
+// most one truncated last line, which is ignored (its job runs again). A write that fails or falls short (e.g. a full
+// disk) is cut off again and disables the journal, so that no partial line merges with the next one. Keys must not
+// contain tabs or newlines.
+
+class job_journal
+{
+  public:
+    job_journal(std::string _filename);                                                                                      // constructor, loads the completed jobs and opens the journal for appending
+    ~job_journal();                                                                                                          // destructor
+    bool completed(const std::string& key, std::vector<double>& values);                                                     // returns whether the job is completed and its results
+    void complete(const std::string& key, const std::vector<double>& values);                                                // records the results of the job durably (thread-safe)
+    uint32_t size();                                                                                                         // returns the number of completed jobs
+  private:
+    std::map<std::string,std::vector<double>> results;                                                                       // results of the completed jobs
+    std::mutex mutex;                                                                                                        // protects results and the file
+    int fd;                                                                                                                  // journal file, opened for appending (-1: disabled)
+    std::string filename;                                                                                                    // name of the journal file
+};
+
+inline
+job_journal::job_journal(std::string _filename) : filename(_filename)
+{
+  std::ifstream in(filename);
+  std::string content((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+  size_t begin = 0;
+  for(size_t end = content.find('\n'); end != std::string::npos; begin = end + 1, end = content.find('\n',begin)){
+    std::string line = content.substr(begin,end-begin);
+    size_t tab = line.find('\t');
+    if(tab == std::string::npos) continue;
+    std::vector<double> values;
+    for(size_t field = tab; field != std::string::npos; field = line.find('\t',field+1)) values.push_back(strtod(line.c_str()+field+1,nullptr));
+    results[line.substr(0,tab)] = values;
+  }
+  fd = open(filename.c_str(),O_WRONLY | O_CREAT | O_APPEND,0644);
+  // drops a truncated last line, so that the next job starts on a line of its own
+  if(fd >= 0 && begin < content.size() && ftruncate(fd,begin) != 0){
+    close(fd);
+    fd = -1;
+  }
+  if(fd < 0) std::cout << "Cannot write the journal " << filename << ", completed jobs will not be recorded." << std::endl;
+}
+
+inline
+job_journal::~job_journal()
+{
+  if(fd >= 0) close(fd);
+}
+
+inline bool
+job_journal::completed(const std::string& key, std::vector<double>& values)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto result = results.find(key);
+  if(result == results.end()) return false;
+  values = result->second;
+  return true;
+}
+
+inline void
+job_journal::complete(const std::string& key, const std::vector<double>& values)
+{
+  std::string line = key;
+  for(double value : values) line += fmt::format("\t{}",value);
+  line += "\n";
+  std::lock_guard<std::mutex> lock(mutex);
+  results[key] = values;
+  if(fd < 0) return;
+  off_t end = lseek(fd,0,SEEK_END);
+  ssize_t written = write(fd,line.data(),line.size());
+  if(written == (ssize_t) line.size() && fsync(fd) == 0) return;
+  std::string error = (written < 0 || written == (ssize_t) line.size()) ? strerror(errno) : "short write";
+  if(written > 0 && end >= 0 && ftruncate(fd,end) != 0) std::cout << "Cannot cut off the partial line at the end of the journal " << filename << ", it is ignored when resuming." << std::endl;
+  std::cout << "Cannot write the journal " << filename << " (" << error << "), further completed jobs will not be recorded." << std::endl;
+  close(fd);
+  fd = -1;
+}
+
+inline uint32_t
+job_journal::size()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return results.size();
+}
+
+#endif
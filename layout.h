@@ -0,0 +1,258 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <cstdint>
+#include <utility>
+
+// A layout maps the lattice coordinates onto a flat site index and provides the nearest neighbours of a site with
+// periodic boundary conditions. Neighbours 2a and 2a+1 are the backward and forward neighbours along axis a; in two
+// dimensions, neighbour k = 0,1,2,3 is up (i-1), down (i+1), left (j-1) and right (j+1). For checkerboard sweeps, the
+// lattice is cut into ARRAY_LEN slabs along the first axis, each consisting of lines along the last axis; (i,j) always
+// denotes the site in the first plane (the one that is displayed).
+
+template <uint16_t ARRAY_LEN>
+struct row_major
+{
+  static constexpr uint8_t dimension = 2;                                            // number of dimensions
+  static constexpr uint8_t coordination = 4;                                         // number of nearest neighbours
+  static constexpr uint32_t volume = ((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN); // number of sites
+  static constexpr uint32_t lines = 1;                                               // number of lines per slab
+  static uint32_t site(uint16_t i, uint16_t j);                                     // returns the site index of (i,j)
+  static uint32_t slab_site(uint16_t i, uint32_t line, uint16_t j);                 // returns the site j of the given line of slab i
+  static uint8_t line_parity(uint32_t line);                                        // returns the parity of the coordinates of the line within its slab
+  static uint16_t row(uint32_t s);                                                  // returns i of the site s
+  static uint16_t col(uint32_t s);                                                  // returns j of the site s
+  static uint16_t coordinate(uint32_t s, uint8_t axis);                             // returns the coordinate of the site s along the axis (0: i, 1: j)
+  static uint32_t neighbour(uint32_t s, uint8_t k);                                 // returns the k-th neighbour of the site s
+};
+
+template <uint16_t ARRAY_LEN> uint32_t
+row_major<ARRAY_LEN>::site(uint16_t i, uint16_t j)
+{
+  return ((uint32_t) i) * ARRAY_LEN + j;
+}
+
+template <uint16_t ARRAY_LEN> uint32_t
+row_major<ARRAY_LEN>::slab_site(uint16_t i, uint32_t, uint16_t j)
+{
+  return site(i,j);
+}
+
+template <uint16_t ARRAY_LEN> uint8_t
+row_major<ARRAY_LEN>::line_parity(uint32_t)
+{
+  return 0;
+}
+
+template <uint16_t ARRAY_LEN> uint16_t
+row_major<ARRAY_LEN>::row(uint32_t s)
+{
+  return s / ARRAY_LEN;
+}
+
+template <uint16_t ARRAY_LEN> uint16_t
+row_major<ARRAY_LEN>::col(uint32_t s)
+{
+  return s % ARRAY_LEN;
+}
+
+template <uint16_t ARRAY_LEN> uint16_t
+row_major<ARRAY_LEN>::coordinate(uint32_t s, uint8_t axis)
+{
+  return (axis == 0) ? row(s) : col(s);
+}
+
+template <uint16_t ARRAY_LEN> uint32_t
+row_major<ARRAY_LEN>::neighbour(uint32_t s, uint8_t k)
+{
+  switch(k){
+    case 0: return (s < ARRAY_LEN) ? s + volume - ARRAY_LEN : s - ARRAY_LEN;
+    case 1: return (s + ARRAY_LEN >= volume) ? s + ARRAY_LEN - volume : s + ARRAY_LEN;
+    case 2: return (s % ARRAY_LEN == 0) ? s + ARRAY_LEN - 1 : s - 1;
+    default: return (s % ARRAY_LEN == ARRAY_LEN - 1) ? s + 1 - ARRAY_LEN : s + 1;
+  }
+}
+
+// Morton (Z-order) layout: the bits of j occupy the even and the bits of i the odd bit positions of the site index, so
+// that every aligned 2^n x 2^n tile is contiguous in memory and vertical neighbours are mostly in the same cache line.
+// The neighbours are computed directly on the interleaved index by carrying through the bits of the other coordinate.
+template <uint16_t ARRAY_LEN>
+struct morton
+{
+  static_assert(ARRAY_LEN > 1 && (ARRAY_LEN & (ARRAY_LEN - 1)) == 0, "the Morton layout requires a power-of-two system length");
+  static constexpr uint8_t dimension = 2;                                            // number of dimensions
+  static constexpr uint8_t coordination = 4;                                         // number of nearest neighbours
+  static constexpr uint32_t volume = ((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN); // number of sites
+  static constexpr uint32_t lines = 1;                                               // number of lines per slab
+  static constexpr uint32_t xmask = 0x55555555u & (volume - 1);                      // bits of the site index holding j
+  static constexpr uint32_t ymask = 0xAAAAAAAAu & (volume - 1);                      // bits of the site index holding i
+  static uint32_t site(uint16_t i, uint16_t j);                                     // returns the site index of (i,j)
+  static uint32_t slab_site(uint16_t i, uint32_t line, uint16_t j);                 // returns the site j of the given line of slab i
+  static uint8_t line_parity(uint32_t line);                                        // returns the parity of the coordinates of the line within its slab
+  static uint16_t row(uint32_t s);                                                  // returns i of the site s
+  static uint16_t col(uint32_t s);                                                  // returns j of the site s
+  static uint16_t coordinate(uint32_t s, uint8_t axis);                             // returns the coordinate of the site s along the axis (0: i, 1: j)
+  static uint32_t neighbour(uint32_t s, uint8_t k);                                 // returns the k-th neighbour of the site s
+  private:
+    static uint32_t spread(uint16_t x);                                             // moves bit n of x to bit 2n
+    static uint16_t compact(uint32_t x);                                            // moves bit 2n of x to bit n
+};
+
+template <uint16_t ARRAY_LEN> uint32_t
+morton<ARRAY_LEN>::spread(uint16_t x)
+{
+  uint32_t v = x;
+  v = (v | (v << 8)) & 0x00FF00FFu;
+  v = (v | (v << 4)) & 0x0F0F0F0Fu;
+  v = (v | (v << 2)) & 0x33333333u;
+  v = (v | (v << 1)) & 0x55555555u;
+  return v;
+}
+
+template <uint16_t ARRAY_LEN> uint16_t
+morton<ARRAY_LEN>::compact(uint32_t x)
+{
+  uint32_t v = x & 0x55555555u;
+  v = (v | (v >> 1)) & 0x33333333u;
+  v = (v | (v >> 2)) & 0x0F0F0F0Fu;
+  v = (v | (v >> 4)) & 0x00FF00FFu;
+  v = (v | (v >> 8)) & 0x0000FFFFu;
+  return v;
+}
+
+template <uint16_t ARRAY_LEN> uint32_t
+morton<ARRAY_LEN>::site(uint16_t i, uint16_t j)
+{
+  return (spread(i) << 1) | spread(j);
+}
+
+template <uint16_t ARRAY_LEN> uint32_t
+morton<ARRAY_LEN>::slab_site(uint16_t i, uint32_t, uint16_t j)
+{
+  return site(i,j);
+}
+
+template <uint16_t ARRAY_LEN> uint8_t
+morton<ARRAY_LEN>::line_parity(uint32_t)
+{
+  return 0;
+}
+
+template <uint16_t ARRAY_LEN> uint16_t
+morton<ARRAY_LEN>::row(uint32_t s)
+{
+  return compact(s >> 1);
+}
+
+template <uint16_t ARRAY_LEN> uint16_t
+morton<ARRAY_LEN>::col(uint32_t s)
+{
+  return compact(s);
+}
+
+template <uint16_t ARRAY_LEN> uint16_t
+morton<ARRAY_LEN>::coordinate(uint32_t s, uint8_t axis)
+{
+  return (axis == 0) ? row(s) : col(s);
+}
+
+template <uint16_t ARRAY_LEN> uint32_t
+morton<ARRAY_LEN>::neighbour(uint32_t s, uint8_t k)
+{
+  switch(k){
+    case 0: return (((s & ymask) - 1) & ymask) | (s & xmask);
+    case 1: return (((s | xmask) + 1) & ymask) | (s & xmask);
+    case 2: return (((s & xmask) - 1) & xmask) | (s & ymask);
+    default: return (((s | ymask) + 1) & xmask) | (s & ymask);
+  }
+}
+
+// Row-major d-dimensional hypercubic lattice: axis 0 has the largest stride, the last axis is contiguous, so that the
+// slabs of the checkerboard sweeps are contiguous blocks. hypercubic<ARRAY_LEN,2> is equivalent to row_major<ARRAY_LEN>.
+constexpr uint64_t
+power(uint64_t base, uint8_t n)
+{
+  return (n == 0) ? 1 : base * power(base,n - 1);
+}
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION>
+struct hypercubic
+{
+  static_assert(DIMENSION >= 2 && power(ARRAY_LEN,DIMENSION) <= 0xFFFFFFFFull, "the hypercubic layout requires 2 or more dimensions and fewer than 2^32 sites");
+  static constexpr uint8_t dimension = DIMENSION;                                    // number of dimensions
+  static constexpr uint8_t coordination = 2 * DIMENSION;                             // number of nearest neighbours
+  static constexpr uint32_t volume = power(ARRAY_LEN,DIMENSION);                     // number of sites
+  static constexpr uint32_t lines = power(ARRAY_LEN,DIMENSION - 2);                  // number of lines per slab
+  static uint32_t site(uint16_t i, uint16_t j);                                     // returns the site index of (i,j) in the first plane
+  static uint32_t slab_site(uint16_t i, uint32_t line, uint16_t j);                 // returns the site j of the given line of slab i
+  static uint8_t line_parity(uint32_t line);                                        // returns the parity of the coordinates of the line within its slab
+  static uint16_t row(uint32_t s);                                                  // returns the coordinate along the second to last axis
+  static uint16_t col(uint32_t s);                                                  // returns the coordinate along the last axis
+  static uint16_t coordinate(uint32_t s, uint8_t axis);                             // returns the coordinate of the site s along the axis
+  static uint32_t neighbour(uint32_t s, uint8_t k);                                 // returns the k-th neighbour of the site s
+};
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION> uint32_t
+hypercubic<ARRAY_LEN,DIMENSION>::site(uint16_t i, uint16_t j)
+{
+  return ((uint32_t) i) * ARRAY_LEN + j;
+}
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION> uint32_t
+hypercubic<ARRAY_LEN,DIMENSION>::slab_site(uint16_t i, uint32_t line, uint16_t j)
+{
+  return (((uint32_t) i) * lines + line) * ARRAY_LEN + j;
+}
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION> uint8_t
+hypercubic<ARRAY_LEN,DIMENSION>::line_parity(uint32_t line)
+{
+  uint32_t sum = 0;
+  for(uint8_t a = 0; a + 2 < DIMENSION; a++){
+    sum += line % ARRAY_LEN;
+    line /= ARRAY_LEN;
+  }
+  return sum % 2;
+}
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION> uint16_t
+hypercubic<ARRAY_LEN,DIMENSION>::row(uint32_t s)
+{
+  return (s / ARRAY_LEN) % ARRAY_LEN;
+}
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION> uint16_t
+hypercubic<ARRAY_LEN,DIMENSION>::col(uint32_t s)
+{
+  return s % ARRAY_LEN;
+}
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION> uint16_t
+hypercubic<ARRAY_LEN,DIMENSION>::coordinate(uint32_t s, uint8_t axis)
+{
+  return (s / power(ARRAY_LEN,DIMENSION - 1 - axis)) % ARRAY_LEN;
+}
+
+template <uint16_t ARRAY_LEN, uint8_t DIMENSION> uint32_t
+hypercubic<ARRAY_LEN,DIMENSION>::neighbour(uint32_t s, uint8_t k)
+{
+  uint32_t stride = power(ARRAY_LEN,DIMENSION - 1 - k/2);
+  uint16_t coordinate = (s / stride) % ARRAY_LEN;
+  if(k % 2 == 0) return (coordinate == 0) ? s + (ARRAY_LEN - 1) * stride : s - stride;
+  return (coordinate == ARRAY_LEN - 1) ? s - (ARRAY_LEN - 1) * stride : s + stride;
+}
+
+// Sums the neighbours of the site s with the stencil unrolled at compile time.
+template <typename LAYOUT, typename T, std::size_t... K> uint8_t
+stencil_sum(const T* spin, uint32_t s, std::index_sequence<K...>)
+{
+  return (spin[LAYOUT::neighbour(s,K)] + ...);
+}
+
+template <typename LAYOUT, typename T> uint8_t
+stencil_sum(const T* spin, uint32_t s)
+{
+  return stencil_sum<LAYOUT>(spin,s,std::make_index_sequence<LAYOUT::coordination>());
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef LIVE_VIEW_H
+#define LIVE_VIEW_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <new>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Live view of a running simulation in a POSIX shared-memory segment: a header with the observables, followed by the
+// first plane of the lattice as one gray byte per site. The simulation writes a frame under a seqlock (the sequence
+// is odd while it writes), hence it never waits for a viewer, and a viewer (viewer.cpp) copies the frame and retries
+// if the sequence has changed meanwhile. Viewers may attach and detach at any time; to end the current run, a viewer
+// sets the stop word, which the sweeps poll.
+
+constexpr uint32_t live_view_magic = 0x49534e47;                                                 // "ISNG", set once the segment is initialized
+
+struct live_view_header
+{
+  uint32_t magic;                                                                                // live_view_magic
+  uint16_t capacity;                                                                             // largest length the segment has room for
+  std::atomic<uint64_t> sequence;                                                                // number of frame writes begun and finished, odd while writing
+  std::atomic<uint32_t> stop;                                                                    // set by a viewer to end the current run, cleared by the simulation
+  int32_t pid;                                                                                   // process of the simulation
+  uint16_t length;                                                                               // length of the current frame
+  double sweeps;                                                                                 // sweeps of the current run
+  double magnetization;                                                                          // magnetization per spin
+  double energy;                                                                                 // energy per spin
+  double temperature;                                                                            // temperature of the current run
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "the seqlock requires address-free atomics");
+
+class live_view
+{
+  public:
+    live_view(std::string _name, uint16_t _capacity);                                            // constructor, creates the segment _name (e.g. "/ising_1234") for lengths up to _capacity
+    ~live_view();                                                                                // destructor, removes the segment
+    template <typename PIXEL> void publish(uint16_t length, PIXEL pixel, double sweeps, double magnetization, double energy, double temperature); // writes the frame with the gray values pixel(i,j)
+    bool stop_requested();                                                                       // returns whether a viewer asked to end the current run, and clears the request
+    static std::string segment(int32_t pid);                                                     // returns the name of the segment of the given process
+    std::string name;                                                                            // name of the segment
+  private:
+    live_view_header* header;                                                                    // mapped segment (nullptr if it could not be created)
+    uint8_t* pixels;                                                                             // frame, row by row, following the header
+    size_t size;                                                                                 // size of the mapping
+};
+
+inline std::string
+live_view::segment(int32_t pid)
+{
+  return "/ising_" + std::to_string(pid);
+}
+
+inline
+live_view::live_view(std::string _name, uint16_t _capacity) : name(_name) , header(nullptr) , pixels(nullptr) , size(sizeof(live_view_header) + (size_t) _capacity * _capacity)
+{
+  int fd = shm_open(name.c_str(),O_RDWR | O_CREAT | O_TRUNC,0644);
+  if(fd >= 0 && ftruncate(fd,size) == 0){
+    void* address = mmap(nullptr,size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    if(address != MAP_FAILED){
+      header = new (address) live_view_header();
+      pixels = (uint8_t*) address + sizeof(live_view_header);
+      header->capacity = _capacity;
+      header->pid = getpid();
+      header->length = 0;
+      header->sequence = 0;
+      header->stop = 0;
+      std::atomic_thread_fence(std::memory_order_release);
+      header->magic = live_view_magic;
+    }
+  }
+  if(fd >= 0) close(fd);
+  if(header == nullptr) std::cout << "Cannot create the shared-memory segment " << name << ", the simulation cannot be viewed." << std::endl;
+}
+
+inline
+live_view::~live_view()
+{
+  if(header == nullptr) return;
+  munmap(header,size);
+  shm_unlink(name.c_str());
+}
+
+template <typename PIXEL> void
+live_view::publish(uint16_t length, PIXEL pixel, double sweeps, double magnetization, double energy, double temperature)
+{
+  if(header == nullptr || length > header->capacity) return;
+  uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+  header->sequence.store(sequence+1,std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  header->length = length;
+  header->sweeps = sweeps;
+  header->magnetization = magnetization;
+  header->energy = energy;
+  header->temperature = temperature;
+  for(uint16_t i = 0; i < length; i++){
+    for(uint16_t j = 0; j < length; j++) pixels[(uint32_t) i*length+j] = pixel(i,j);
+  }
+  header->sequence.store(sequence+2,std::memory_order_release);
+}
+
+inline bool
+live_view::stop_requested()
+{
+  return header != nullptr && header->stop.load(std::memory_order_relaxed) != 0 && header->stop.exchange(0) != 0;
+}
+
+#endif
@@ -2,33 +2,592 @@
 #include <fstream>
 #include <vector>
 #include <chrono>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <algorithm>
 
-#define DISPLAY                      // if defined, a window will open and display the current configuration
+#define DISPLAY                      // if defined, the current configuration is published in the shared-memory segment /ising_<pid>, to be watched with ./viewer
+//#define TEMPORAL_BLOCKING          // if defined, temporally blocked checkerboard sweeps on all cores replace the random-site updates
+//#define NFOLD                      // if defined, the rejection-free n-fold way replaces the random-site updates (for low temperatures)
+//#define MULTISPIN                  // if defined, 64 replicas are simulated at once, packed into the bits of one lattice (no display)
+//#define HEAT_BATH                  // if defined, the heat-bath (Glauber) rule replaces the Metropolis acceptance
+//#define OVERRELAXATION             // if defined, every Metropolis sweep is followed by an overrelaxation sweep
+//#define EXTERNAL_FIELD 0.1         // if defined, a uniform external field h = EXTERNAL_FIELD is applied
+//#define VERTICAL_COUPLING 0.5      // if defined, the vertical coupling is J_y = VERTICAL_COUPLING (J_x = 1)
+//#define CACHED_FIELDS              // if defined, the local state of every site is cached and updated on accepted flips only
+//#define MORTON                     // if defined, the spins are stored in Morton (Z-order) instead of row-major order (requires a power-of-two L)
+//#define LATTICE_DIMENSION 3        // if defined, a LATTICE_DIMENSION-dimensional hypercubic lattice is simulated (reduce L), the first plane is displayed
+//#define POTTS 3                    // if defined, the POTTS-state Potts model is simulated instead of the Ising model
+//#define CLOCK 6                    // if defined, the CLOCK-state clock model is simulated instead of the Ising model
+//#define CLUSTER                    // if defined, the Potts and clock models are simulated with Wolff cluster updates
+//#define ANTIFERRO_FRACTION 0.1     // if defined, a fraction ANTIFERRO_FRACTION of random bonds is antiferromagnetic (averaged over SAMPLES realizations, reduce L)
+//#define VACANCY_FRACTION 0.1       // if defined, a fraction VACANCY_FRACTION of random sites is vacant (averaged over SAMPLES realizations, reduce L)
+#define SAMPLES 1000                 // number of realizations of the quenched disorder per temperature
+//#define ANNEAL                     // if defined, every chain is carried over from one temperature to the next in the order of the list, equilibrated adaptively
+//#define HYSTERESIS                 // if defined, the temperature list is traversed forth and back (to be used with ANNEAL)
+//#define REFINE 0.005               // if defined, the temperature list is refined around the peaks of x and c and the crossing of U_L for L and L/2 down to REFINE, on all cores (no display)
+//#define CAMPAIGN 16,32,64,128      // if defined, all temperatures are simulated for all lengths CAMPAIGN (increasing), longest jobs first on all cores, followed by Binder crossing and scaling collapse tables (no display)
+//#define RESUME                     // if defined, completed runs are journaled in basename_journal.dat and replayed instead of simulated when the same command is run again
+//#define WANG_LANDAU 1e-6           // if defined, the density of states of every length is estimated once by replica-exchange Wang-Landau sampling on all cores down to ln f = WANG_LANDAU, all temperatures follow by reweighting (reduce L, no display)
+//#define CORRELATION_FUNCTION 100   // if defined, G(r) is evaluated in the background on a snapshot every CORRELATION_FUNCTION cycles and written to results/ (metropolis and nfold engines)
+//#define CLUSTER_STATISTICS 100     // if defined, the geometric spin clusters of a snapshot are labelled in the background every CLUSTER_STATISTICS cycles and their size distribution is written to results/ (metropolis and nfold engines)
+//#define VIDEO_RESOLUTION 1024      // if defined, the video frames are box-filtered down to at most VIDEO_RESOLUTION pixels per side
+//#define VIDEO_REGION 0,0,512       // if defined, the video shows only the square top,left,size of the (first plane of the) lattice
+//#define VIDEO_BUDGET 0.05          // if defined, video frames are skipped to keep rendering and encoding below this fraction of the wall time
+//#define VIDEO_PIPE "ffmpeg -loglevel error -y -f rawvideo -pix_fmt bgr24 -s {width}x{height} -r 30 -i - -c:v libx264 -preset veryfast {name}" // if defined, raw frames are piped to this encoder instead of cv::VideoWriter
+//#define ARCHIVE 10                 // if defined, the exact state is appended to the snapshot archive results/beta=..._N=..._bias=....isa every ARCHIVE cycles (see ./render_archive)
+#define PROGRESS 60                  // seconds between the progress reports (sweep rate and remaining time) of every run, 0: none
+//#define PERF_COUNTERS              // if defined, the sweeps of every run are counted by the hardware performance counters (perf_event_open) and the events per flip are written to results/
+//#define METRICS "9100"             // if defined, the runs, job queues and worker threads are exported in the Prometheus text format on this loopback port (or Unix socket, if a path), see metrics.h
+#define SNAPSHOT_BUFFERS 2           // number of snapshots in flight between the sweeps and the measurements on worker threads (0: measure between the sweeps)
+//#define CACHE "results/cache"      // if defined, the results of every run are stored in the directory CACHE under the hash of its parameters and reused by all later runs with the same parameters
+
+#if defined(REFINE) || defined(CAMPAIGN) || defined(WANG_LANDAU)
+#undef DISPLAY                       // one view per process, and the runs are concurrent
+#endif
+#if defined(REFINE) || defined(CAMPAIGN)
+#undef SNAPSHOT_BUFFERS
+#define SNAPSHOT_BUFFERS 0           // the concurrent runs occupy all cores, stage threads per run would oversubscribe them
+#endif
 
 #include "configuration.h"
 #include "metropolis.h"
+#include "multispin.h"
+#include "nfold.h"
+#include "qstate.h"
+#include "disorder.h"
+#include "jobs.h"
+#include "grid.h"
+#include "campaign.h"
+#include "journal.h"
+#include "cache.h"
+#include "wang_landau.h"
+#include "shutdown.h"
+#include "metrics.h"
 
 #define L 256                        // system length
+#if __has_include("code_version.h")
+#include "code_version.h"            // CODE_VERSION, written at every build by CMake (see code_version.cmake)
+#endif
+#ifndef CODE_VERSION
+#define CODE_VERSION "unknown"       // revision of the code and hash of the sources, part of the keys of the results cache
+#endif
+
+#if defined(LATTICE_DIMENSION)
+template <uint16_t LEN> using layout = hypercubic<LEN,LATTICE_DIMENSION>;
+#elif defined(MORTON)
+template <uint16_t LEN> using layout = morton<LEN>;
+#else
+template <uint16_t LEN> using layout = row_major<LEN>;
+#endif
+
+#if defined(ANTIFERRO_FRACTION) || defined(VACANCY_FRACTION)
+#define DISORDER
+template <uint16_t LEN> using fields = disordered_fields<layout<LEN>>;
+#elif defined(CACHED_FIELDS)
+template <uint16_t LEN> using fields = cached_fields<layout<LEN>>;
+#else
+template <uint16_t LEN> using fields = computed_fields<layout<LEN>>;
+#endif
+
+#if defined(HEAT_BATH)
+typedef heat_bath_rule rule;
+constexpr const char* rule_name = "heat_bath";
+#elif defined(OVERRELAXATION)
+typedef overrelaxed_metropolis_rule rule;
+constexpr const char* rule_name = "overrelaxed_metropolis";
+#else
+typedef metropolis_rule rule;
+constexpr const char* rule_name = "metropolis";
+#endif
+
+#ifdef EXTERNAL_FIELD
+constexpr float field = EXTERNAL_FIELD;
+#else
+constexpr float field = 0;
+#endif
+#ifdef VERTICAL_COUPLING
+constexpr float vertical_coupling = VERTICAL_COUPLING;
+#else
+constexpr float vertical_coupling = 1;
+#endif
+#ifdef ANTIFERRO_FRACTION
+constexpr double antiferro_fraction = ANTIFERRO_FRACTION;
+#else
+constexpr double antiferro_fraction = 0;
+#endif
+#ifdef VACANCY_FRACTION
+constexpr double vacancy_fraction = VACANCY_FRACTION;
+#else
+constexpr double vacancy_fraction = 0;
+#endif
+typedef couplings<field != 0,vertical_coupling != 1> coupling;
+
+#if defined(POTTS)
+template <uint16_t LEN> using engine = qstate<LEN,potts_model<POTTS>,layout<LEN>,rule>;
+const std::string model_name = fmt::format("potts_q={}",POTTS);
+#elif defined(CLOCK)
+template <uint16_t LEN> using engine = qstate<LEN,clock_model<CLOCK>,layout<LEN>,rule>;
+const std::string model_name = fmt::format("clock_q={}",CLOCK);
+#elif defined(NFOLD)
+template <uint16_t LEN> using engine = nfold<LEN,layout<LEN>,fields<LEN>,rule,coupling>;
+const std::string model_name = "ising";
+#else
+template <uint16_t LEN> using engine = metropolis<LEN,layout<LEN>,fields<LEN>,rule,coupling>;
+const std::string model_name = "ising";
+#endif
+
+#if defined(WANG_LANDAU)
+constexpr const char* scheme_name = "wang_landau";
+#elif defined(MULTISPIN)
+constexpr const char* scheme_name = "multispin";
+#elif defined(NFOLD)
+constexpr const char* scheme_name = "nfold";
+#elif defined(CLUSTER) && (defined(POTTS) || defined(CLOCK))
+constexpr const char* scheme_name = "wolff";
+#elif defined(TEMPORAL_BLOCKING)
+constexpr const char* scheme_name = "checkerboard";
+#else
+constexpr const char* scheme_name = "random_site";
+#endif
+
+#if defined(ANNEAL) && (defined(POTTS) || defined(CLOCK) || defined(MULTISPIN) || defined(DISORDER))
+#error "annealing is only implemented for the metropolis and nfold engines"
+#endif
+#if defined(WANG_LANDAU) && (defined(POTTS) || defined(CLOCK) || defined(MULTISPIN) || defined(DISORDER) || defined(ANNEAL) || defined(EXTERNAL_FIELD) || defined(VERTICAL_COUPLING))
+#error "the Wang-Landau engine is only implemented for the clean, zero-field, isotropic Ising model"
+#endif
+#if defined(NFOLD) && (defined(OVERRELAXATION) || defined(TEMPORAL_BLOCKING))
+#error "the n-fold way replaces the sweeps, it has neither overrelaxation nor blocked sweeps"
+#endif
+#if (defined(MULTISPIN) || defined(POTTS) || defined(CLOCK)) && (defined(EXTERNAL_FIELD) || defined(VERTICAL_COUPLING))
+#error "the external field and the vertical coupling are only implemented for the metropolis and nfold engines"
+#endif
+#if defined(MULTISPIN) && (defined(HEAT_BATH) || defined(OVERRELAXATION))
+#error "the multispin engine only implements the Metropolis rule"
+#endif
+#if defined(ANNEAL) && (defined(REFINE) || defined(CAMPAIGN))
+#error "annealing requires the temperatures in the order of the list"
+#endif
+#if defined(REFINE) && defined(CAMPAIGN)
+#error "the refinement and the campaign are exclusive"
+#endif
+#if (defined(RESUME) || defined(CACHE)) && defined(HYSTERESIS)
+#error "the journal and the cache identify runs by their temperature, which the hysteresis loop repeats"
+#endif
+#if defined(CACHE) && defined(ANNEAL)
+#error "an annealed run depends on all temperatures before it, which the keys of the cache do not hold"
+#endif
+
+#if defined(LATTICE_DIMENSION) && LATTICE_DIMENSION == 3
+constexpr double nu = 0.6300;                               // critical exponents of the Ising universality class for the scaling collapse
+constexpr double gamma_over_nu = 1.9637;
+#else
+constexpr double nu = 1;
+constexpr double gamma_over_nu = 1.75;
+#endif
+
+// returns the number of sweeps averaged over per run, decreasing with the length as larger systems self-average
+constexpr uint32_t
+production_cycles(uint16_t length)
+{
+  return (length < 32)? 50000*128/length*128/length : 12500*512/length;
+}
+
+// returns the number of sweeps of one call to simulate<LEN>(), the basis of the cost estimate of a campaign
+constexpr double
+sweeps_per_temperature([[maybe_unused]] uint16_t length)
+{
+#if defined(WANG_LANDAU)
+  return 100000;
+#elif defined(DISORDER)
+  return SAMPLES*(1000.+10000.);
+#elif defined(MULTISPIN)
+  return 5000.+production_cycles(length);
+#else
+  return 10*(5000.+production_cycles(length));
+#endif
+}
+
+std::mutex results_mutex;                                   // serializes the output of concurrent simulations
+std::unique_ptr<job_journal> journal;                       // completed runs of this and earlier invocations (RESUME)
+std::unique_ptr<results_cache> cache;                       // completed runs of all campaigns (CACHE)
+std::unique_ptr<live_view> view;                            // segment watched by ./viewer (DISPLAY)
+std::unique_ptr<metrics_exporter> exporter;                 // serves the metrics of the runs (METRICS)
+
+constexpr uint8_t record_format = 3;                        // layout of the journaled and cached records (3: bias, 6 averages with |m(k)|^2, x and c)
+constexpr uint8_t record_values = 9;                        // number of values per record in record_format
+
+// identifies a run of the length LEN at the temperature T with the given bias (0: all biases at once) in the journal
+// and the manifest, including the model, the update scheme and the record format, so that only runs of the same kind
+// are replayed and records of an older format are simulated again rather than read with the wrong stride
+template <uint16_t LEN> std::string
+run_key(float T, float bias)
+{
+  return fmt::format("L={} d={} T={:.6g} bias={:.6g} {} h={} J_y={} af={} vac={} {} {} sweeps={} records={}",LEN,layout<LEN>::dimension,T,bias,model_name,field,vertical_coupling,antiferro_fraction,vacancy_fraction,rule_name,scheme_name,sweeps_per_temperature(LEN),record_format);
+}
+
+// returns the biases of the runs of one temperature as they appear in the keys
+std::vector<float>
+run_biases()
+{
+#if defined(WANG_LANDAU) || defined(DISORDER) || defined(MULTISPIN)
+  return {0};
+#else
+  std::vector<float> biases;
+  for(uint8_t k = 1; k < 11; k++) biases.push_back(std::exp(0.2*k));
+  return biases;
+#endif
+}
+
+// writes the keys of all runs of the length LEN at the given temperatures to the manifest, and returns the number of
+// those already in the journal
+template <uint16_t LEN> uint32_t
+write_manifest(std::ofstream& manifest, const std::vector<float>& temperatures)
+{
+  uint32_t completed = 0;
+  std::vector<double> values;
+  for(float T : temperatures){
+    for(float bias : run_biases()){
+      std::string key = run_key<LEN>(T,bias);
+      manifest << key << std::endl;
+      if(journal && journal->completed(key,values)) completed++;
+    }
+  }
+  return completed;
+}
+
+// writes the manifest of all lengths LENS
+template <uint16_t... LENS> uint32_t
+write_manifest_of(std::ofstream& manifest, const std::vector<float>& temperatures)
+{
+  return (write_manifest<LENS>(manifest,temperatures) + ...);
+}
+
+// simulates the system of length LEN at the temperature T with all biases (or samples), writes the averages to the
+// results files and adds the averages over the biases to the temperature grid (if any) as a point of the given size
+template <uint16_t LEN> void
+simulate(float T, std::ofstream& results_dist, std::ofstream& results_stdev, temperature_grid* grid = nullptr, uint8_t size = 0)
+{
+#ifdef ANNEAL
+  // the chains of every length persist from one call to the next
+  static std::vector<std::unique_ptr<engine<LEN>>> chains;
+#endif
+  float beta = 1./T;
+  std::vector<double> mag_list;
+  std::vector<double> mag2_list;
+  std::vector<double> mag4_list;
+  std::vector<double> e_list;
+  std::vector<double> e2_list;
+  std::vector<double> x_list;
+  std::vector<double> c_list;
+  std::vector<double> U_L_list;
+  std::vector<double> xi_list;
+  std::vector<double> records;
+  // evaluates and records the averages of one run (or one replica), x and c are computed from the moments unless given
+  auto record = [&](float bias, double magnetization, double magnetization_squared, double magnetization_fourth, double energy, double energy_squared, double fourier_squared, double susceptibility = NAN, double heat_capacity = NAN){
+    if(std::isnan(susceptibility)) susceptibility = (magnetization_squared-magnetization*magnetization)/T*layout<LEN>::volume;
+    if(std::isnan(heat_capacity)) heat_capacity = (energy_squared-energy*energy)/(T*T)*layout<LEN>::volume;
+    double binder_cumulant = 1-magnetization_fourth/(3.*magnetization_squared*magnetization_squared);
+    double correlation_length = sqrt(std::max(magnetization_squared/fourier_squared-1,0.))/(2*sin(M_PI/LEN));
+    std::lock_guard<std::mutex> lock(results_mutex);
+    std::cout << "L = " << LEN << ", T = " << T << ", bias = " << bias << ": m = " << magnetization << ", m^2 = " << magnetization_squared << ", e = " << energy << ", e^2 = " << energy_squared << ", x = " << susceptibility << ", c = " << heat_capacity << ", U_L = " << binder_cumulant << ", xi = " << correlation_length << std::endl;
+    mag_list.push_back(magnetization);
+    mag2_list.push_back(magnetization_squared);
+    mag4_list.push_back(magnetization_fourth);
+    e_list.push_back(energy);
+    e2_list.push_back(energy_squared);
+    x_list.push_back(susceptibility);
+    c_list.push_back(heat_capacity);
+    U_L_list.push_back(binder_cumulant);
+    xi_list.push_back(correlation_length);
+    records.insert(records.end(),{bias,magnetization,magnetization_squared,magnetization_fourth,energy,energy_squared,fourier_squared,susceptibility,heat_capacity});
+    results_dist << LEN << "\t" << T << "\t" << bias << "\t" << magnetization << "\t" << magnetization_squared << "\t" << magnetization_fourth << "\t" << energy << "\t" << energy_squared << "\t" << susceptibility << "\t" << heat_capacity << "\t" << binder_cumulant << "\t" << correlation_length << std::endl;
+  };
+  // replays the records of a journaled or cached run instead of simulating it again
+  auto resume = [&](const std::string& key){
+    std::vector<double> values;
+    // a journal entry that does not hold whole records is damaged, the cache is tried and else the run simulated again
+    if(!(journal && journal->completed(key,values) && values.size() % record_values == 0)){
+      if(!(cache && cache->find(key,values) && values.size() % record_values == 0)) return false;
+      if(journal) journal->complete(key,values);
+    }
+    for(size_t r = 0; r + record_values <= values.size(); r += record_values) record(values[r],values[r+1],values[r+2],values[r+3],values[r+4],values[r+5],values[r+6],values[r+7],values[r+8]);
+    return true;
+  };
+  // journals and caches the records of a run, starting at the record with the given index
+  auto complete = [&](const std::string& key, size_t first){
+    std::vector<double> values(records.begin()+record_values*first,records.end());
+    if(journal) journal->complete(key,values);
+    if(cache) cache->store(key,values);
+  };
+#if defined(WANG_LANDAU)
+  // one density of states per length serves all temperatures
+  std::string key = run_key<LEN>(T,0);
+  if(!resume(key)){
+    static std::unique_ptr<wang_landau<LEN,layout<LEN>,fields<LEN>>> dos = [](){
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      std::unique_ptr<wang_landau<LEN,layout<LEN>,fields<LEN>>> dos(new wang_landau<LEN,layout<LEN>,fields<LEN>>());
+      dos->run(WANG_LANDAU,sweeps_per_temperature(LEN));
+      if(!dos->interrupted) dos->write(fmt::format("results/dos_N={:d}.dat",LEN));
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      std::cout << "Wang-Landau took " << std::chrono::duration_cast<std::chrono::seconds> (end - begin).count() << " seconds." << std::endl;
+      return dos;
+    }();
+    // an interrupted density of states is not converged
+    if(dos->interrupted) return;
+    canonical_averages mean = dos->canonical(beta);
+    record(0,mean.magnetization,mean.magnetization_squared,mean.magnetization_fourth,mean.energy,mean.energy_squared,NAN);
+    complete(key,0);
+  }
+#elif defined(DISORDER)
+  // for each temperature, average over SAMPLES realizations of the disorder, simulated concurrently on all cores
+  std::string key = run_key<LEN>(T,0);
+  if(!resume(key)){
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    disorder_average<engine<LEN>> samples(beta,antiferro_fraction,vacancy_fraction);
+    samples.set_couplings(1,vertical_coupling,field);
+    samples.run(SAMPLES,std::thread::hardware_concurrency(),1000,10000);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "run() took " << std::chrono::duration_cast<std::chrono::seconds> (end - begin).count() << " seconds:" << std::endl;
+    std::cout << "Disorder average over " << SAMPLES << " samples: x = " << samples.susceptibility.mean << " +- " << samples.susceptibility.error() << " (sample-to-sample " << samples.susceptibility.stdev() << "), c = " << samples.heat_capacity.mean << " +- " << samples.heat_capacity.error() << ", U_L = " << samples.binder_cumulant.mean << " +- " << samples.binder_cumulant.error() << std::endl;
+    if(samples.magnetization.n == 0) return;
+    // x and c are averaged over the samples, each normalized by its occupied sites and free of the sample-to-sample
+    // fluctuations of |m| and e, which the averaged moments would add
+    record(0,samples.magnetization.mean,samples.magnetization_squared.mean,samples.magnetization_fourth.mean,samples.energy.mean,samples.energy_squared.mean,samples.fourier_squared.mean,samples.susceptibility.mean,samples.heat_capacity.mean);
+    // the samples of an interrupted average are fewer than SAMPLES
+    if(!shutdown_requested()) complete(key,0);
+  }
+#else
+  uint32_t total_cycles = production_cycles(LEN);
+#if defined(MULTISPIN)
+  // for each temperature, run 64 replicas packed into the bits of one lattice, cycling through the 10 biases
+  std::vector<float> biases;
+  for(uint8_t k = 1; k < 11; k++) biases.push_back(std::exp(0.2*k));
+  std::string key = run_key<LEN>(T,0);
+  if(!resume(key)){
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    multispin<LEN,layout<LEN>>* replicas = new multispin<LEN,layout<LEN>>(beta,biases);
+    replicas->run(5000,total_cycles,1);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "run() took " << std::chrono::duration_cast<std::chrono::seconds> (end - begin).count() << " seconds:" << std::endl;
+    for(uint8_t r = 0; r < replicas->replicas && replicas->samples > 0; r++){
+      record(biases[r % biases.size()],replicas->mean_magnetization[r],replicas->mean_magnetization_squared[r],replicas->mean_magnetization_fourth[r],replicas->mean_energy[r],replicas->mean_energy_squared[r],NAN);
+    }
+    bool interrupted = replicas->interrupted;
+    delete replicas;
+    if(!interrupted) complete(key,0);
+  }
+#else
+  // for each temperature, use 10 different initial conditions with differnt bias
+  for(uint8_t k = 1; k < 11; k++){
+    float bias = std::exp(0.2*k);
+    std::string key = run_key<LEN>(T,bias);
+#ifdef ANNEAL
+    // the chain of every bias continues from its configuration at the previous temperature
+    if(chains.size() < k) chains.emplace_back(new engine<LEN>(fmt::format("results/anneal_N={:d}_bias={:.2f}",LEN,bias),beta,bias));
+#endif
+#ifdef ANNEAL
+    // a journaled run is not simulated again, but its chain still has to follow the temperatures
+    if(resume(key)){
+      if(shutdown_requested()) break;
+      chains[k-1]->set_beta(beta);
+      chains[k-1]->set_couplings(1,vertical_coupling,field);
+      chains[k-1]->equilibrate();
+      continue;
+    }
+#else
+    if(resume(key)) continue;
+#endif
+    if(shutdown_requested()) break;
+    size_t first = records.size()/record_values;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point end;
+#if defined(POTTS) || defined(CLOCK)
+    engine<LEN> metrop(beta,bias);
+#ifdef CLUSTER
+    metrop.set_cluster_updates(true);
+#endif
+#else
+#ifdef ANNEAL
+    engine<LEN>& metrop = *chains[k-1];
+    metrop.set_beta(beta);
+#else
+    engine<LEN> metrop(beta,bias);
+#endif
+    metrop.set_couplings(1,vertical_coupling,field);
+#ifdef TEMPORAL_BLOCKING
+    metrop.set_temporal_blocking(32,8,std::thread::hardware_concurrency());
+#endif
+#endif
+    metrop.set_snapshot_buffers(SNAPSHOT_BUFFERS);
+    metrop.set_progress(PROGRESS);
+#ifdef DISPLAY
+    metrop.set_live_view(view.get());
+#endif
+#ifdef PERF_COUNTERS
+    metrop.set_perf_counters(true);
+#endif
+#if !defined(POTTS) && !defined(CLOCK)
+#if defined(VIDEO_RESOLUTION) && defined(VIDEO_REGION)
+    metrop.set_rendering(VIDEO_RESOLUTION,VIDEO_REGION);
+#elif defined(VIDEO_RESOLUTION)
+    metrop.set_rendering(VIDEO_RESOLUTION);
+#elif defined(VIDEO_REGION)
+    metrop.set_rendering(0,VIDEO_REGION);
+#endif
+#ifdef VIDEO_BUDGET
+    metrop.set_frame_budget(VIDEO_BUDGET);
+#endif
+#ifdef VIDEO_PIPE
+    metrop.set_video_pipe(VIDEO_PIPE);
+#endif
+#ifdef ARCHIVE
+    metrop.set_archive(ARCHIVE);
+#endif
+#ifdef CORRELATION_FUNCTION
+    metrop.set_correlation_function(CORRELATION_FUNCTION);
+#endif
+#ifdef CLUSTER_STATISTICS
+    metrop.set_cluster_statistics(CLUSTER_STATISTICS,std::max(std::thread::hardware_concurrency()/2,1u));
+#endif
+#endif
+    begin = std::chrono::steady_clock::now();
+    uint32_t frame_cycles = (LEN < 256)? 2*512/LEN*512/LEN : 10*LEN/256;
+#ifdef ANNEAL
+    std::cout << "Equilibrated after " << metrop.equilibrate() << " cycles." << std::endl;
+    double magnetization = metrop.run(0,total_cycles,1,frame_cycles);
+#else
+    double magnetization = metrop.run(5000,total_cycles,1,frame_cycles);
+#endif
+    end = std::chrono::steady_clock::now();
+    std::cout << "run() took " << std::chrono::duration_cast<std::chrono::seconds> (end - begin).count() << " seconds:" << std::endl;
+    // the averages of an interrupted run are reported, but the run is simulated again when resumed
+    if(metrop.interrupted) std::cout << "Interrupted after averaging " << metrop.samples << " snapshots." << std::endl;
+    if(metrop.samples == 0) continue;
+    record(bias,magnetization,metrop.mean_magnetization_squared,metrop.mean_magnetization_fourth,metrop.mean_energy,metrop.mean_energy_squared,metrop.mean_fourier_squared);
+#if !defined(POTTS) && !defined(CLOCK)
+#ifdef CORRELATION_FUNCTION
+    std::ofstream correlation_file(fmt::format("results/correlation_beta={:.4f}_N={:d}_bias={:.2f}.dat",beta,LEN,bias),std::ofstream::out);
+    correlation_file << "r\tG\n";
+    std::vector<double> correlation_function = metrop.get_correlation_function();
+    for(size_t r = 0; r < correlation_function.size(); r++) correlation_file << r << "\t" << correlation_function[r] << std::endl;
+#endif
+#ifdef CLUSTER_STATISTICS
+    cluster_summary domains = metrop.get_cluster_statistics();
+    std::cout << "Clusters: " << domains.largest_fraction.n << " snapshots, largest = " << domains.largest_fraction.mean << " +- " << domains.largest_fraction.error() << ", clusters per site = " << domains.clusters_per_site.mean << ", mean size = " << domains.mean_cluster_size.mean << " +- " << domains.mean_cluster_size.error() << std::endl;
+    std::ofstream cluster_file(fmt::format("results/clusters_beta={:.4f}_N={:d}_bias={:.2f}.dat",beta,LEN,bias),std::ofstream::out);
+    cluster_file << "s\tn_s\n";
+    for(size_t size = 1; size < domains.size_distribution.size(); size++){
+      if(domains.size_distribution[size] > 0) cluster_file << size << "\t" << domains.size_distribution[size] << std::endl;
+    }
+#endif
+#endif
+#ifdef PERF_COUNTERS
+    std::ofstream perf_file(fmt::format("results/perf_beta={:.4f}_N={:d}_bias={:.2f}.dat",beta,LEN,bias),std::ofstream::out);
+    perf_file << "event\tcount\tper_flip\tper_proposal\n";
+    perf_file << "flips\t" << metrop.run_flips << "\t1\t" << (double) metrop.run_flips/metrop.run_proposals << std::endl;
+    for(uint8_t event = 0; event < perf_events; event++) perf_file << perf_counters::name(event) << "\t" << metrop.counters.value[event] << "\t" << metrop.counters.per((perf_event_id) event,metrop.run_flips) << "\t" << metrop.counters.value[event]/metrop.run_proposals << std::endl;
+#endif
+    if(!metrop.interrupted) complete(key,first);
+  }
+#endif
+#endif
+  // every run was interrupted before averaging
+  if(mag_list.empty()) return;
+  std::lock_guard<std::mutex> lock(results_mutex);
+  std::cout << "Summary: L = " << LEN << ", T = " << T << ": m = " << avg(mag_list) << " +- " << stdev(mag_list) << ", e = " << avg(e_list) << " +- " << stdev(e_list) << ", x = " << avg(x_list) << " +- " << stdev(x_list) << ", c = " << avg    (c_list) << " +- " << stdev(c_list) << ", U_L = " << avg(U_L_list) << " +- " << stdev(U_L_list) << ", xi = " << avg(xi_list) << " +- " << stdev(xi_list) << std::endl;
+  results_stdev << LEN << "\t" << T << "\t" << avg(mag_list) << "\t" << stdev(mag_list) << "\t" << avg(mag2_list) << "\t" << stdev(mag2_list) << "\t" << avg(mag4_list) << "\t" << stdev(mag4_list) << "\t" << avg(e_list) << "\t" << stdev(e_list) << "\t" << avg(e2_list) << "\t" << stdev(e2_list) << "\t" << avg(x_list) << "\t" << stdev(x_list) << "\t" << avg(c_list) << "\t" << stdev(c_list) << "\t" << avg(U_L_list) << "\t" << stdev(U_L_list) << "\t" << avg(xi_list) << "\t" << stdev(xi_list) << std::endl;
+  if(grid) grid->add(size,T,avg(x_list),avg(c_list),avg(U_L_list),(U_L_list.size() > 1) ? stdev(U_L_list)/sqrt(U_L_list.size()) : 0.);
+}
+
+#ifdef CAMPAIGN
+// exposes the sweeps of an engine for timing
+template <typename ENGINE>
+struct calibration : ENGINE
+{
+  using ENGINE::ENGINE;
+  using ENGINE::advance;
+};
+
+// returns the wall time of one sweep of the engine of length LEN at the temperature T, measured over about 10^7 site
+// updates on a single thread
+template <uint16_t LEN> double
+calibrate(float T)
+{
+  uint32_t sweeps = std::max<uint64_t>(10000000/layout<LEN>::volume,1);
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+#if defined(MULTISPIN)
+  multispin<LEN,layout<LEN>> replicas(1./T,{1});
+  for(uint32_t n = 0; n < sweeps; n++) replicas.sweep();
+#elif defined(POTTS) || defined(CLOCK)
+  calibration<engine<LEN>> sample(1./T);
+#ifdef CLUSTER
+  sample.set_cluster_updates(true);
+#endif
+  sample.advance(sweeps);
+#else
+  calibration<engine<LEN>> sample("",1./T);
+#ifdef TEMPORAL_BLOCKING
+  sample.set_temporal_blocking(32,8,std::thread::hardware_concurrency());
+#endif
+  sample.advance(sweeps);
+#endif
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - begin).count()/sweeps;
+}
+
+// simulates all temperatures for all lengths LENS, longest jobs first on all cores, and writes the Binder crossings and
+// the scaling collapse
+template <uint16_t... LENS> void
+campaign(const std::vector<float>& temperatures, std::ofstream& results_dist, std::ofstream& results_stdev, const std::string& results_base_filename)
+{
+  scaling_campaign plan({LENS...});
+  uint8_t size = 0;
+  ([&]{
+    double cost = sweeps_per_temperature(LENS)*calibrate<LENS>(temperatures[temperatures.size()/2]);
+    std::cout << "L = " << LENS << ": estimated " << cost << " seconds per temperature." << std::endl;
+    for(float T : temperatures) plan.add(size,T,cost,[&,T,size]{ simulate<LENS>(T,results_dist,results_stdev,&plan.grid,size); });
+    size++;
+  }(), ...);
+  plan.run();
+  std::ofstream results_crossings(results_base_filename+"_crossings.dat",std::ofstream::out);
+  plan.write_crossings(results_crossings);
+  std::ofstream results_collapse(results_base_filename+"_collapse.dat",std::ofstream::out);
+  plan.write_collapse(results_collapse,nu,gamma_over_nu);
+}
+#endif
 
 int main(int argc, char *argv[]){
   if(argc < 3){
     std::cout << "Usage:\n\tOption 1: " << argv[0] << " basename temperature\n\tOption 2: " << argv[0] << " basename temperature_start temperature_end temperature_step\n\tOption 3: " << argv[0] << " basename temp1 temp2 temp3 temp4 ..." <<     std::endl;
     return 0;
   }
+  install_shutdown_handlers();
   std::string results_base_filename = argv[1];
   std::vector<float> temperature_list;
   if(argc == 5){
-    for(uint8_t k = 0; k < (atof(argv[3])-atof(argv[2]))/(atof(argv[4]))+1; k++)
+    // a range that the step does not traverse would give a negative number of points
+    if(!(atof(argv[4]) > 0 && atof(argv[3]) >= atof(argv[2]))){
+      std::cout << "The temperature range must have temperature_start <= temperature_end and a positive temperature_step." << std::endl;
+      return 1;
+    }
+    uint32_t points = floor((atof(argv[3])-atof(argv[2]))/(atof(argv[4]))+1e-6)+1;
+    for(uint32_t k = 0; k < points; k++)
     {
       temperature_list.push_back(atof(argv[2])+atof(argv[4])*k);
     }
   }
   else{
-    for(uint8_t k = 2; k < argc; k++)
+    for(int k = 2; k < argc; k++)
     {
       temperature_list.push_back(atof(argv[k]));
     }
   }
+#ifdef HYSTERESIS
+  for(int32_t i = temperature_list.size()-2; i >= 0; i--) temperature_list.push_back(temperature_list[i]);
+#endif
   std::cout << "Will use the following temperatures: ";
   for(uint16_t i = 0; i < temperature_list.size(); i++){
     std::cout << temperature_list[i] << " ";
@@ -36,50 +595,55 @@ int main(int argc, char *argv[]){
   std::cout << std::endl;
   std::ofstream results_dist(results_base_filename+"_dist.dat",std::ofstream::out);
   std::ofstream results_stdev(results_base_filename+"_stdev.dat",std::ofstream::out);
-  results_dist << "L\tT\tbias\tmag\tmag2\tmag4\te\te2\tx\tc\tU_L\n";
-  results_stdev << "L\tT\tavg_mag\tstdev_mag\tavg_mag2\tstdev_mag2\tavg_mag4\tstdev_mag4\tavg_e\tstdev_e\tavg_e2\tstdev_e2\tavg_x\tstdev_x\tavg_c\tstdev_c\tavg_U_L\tstdev_U_L\n";
-  // for each temperature in the list do...
-  for(uint16_t i = 0; i < temperature_list.size(); i++){
-    float T = temperature_list[i];
-    float beta = 1./T;
-    std::vector<double> mag_list;
-    std::vector<double> mag2_list;
-    std::vector<double> mag4_list;
-    std::vector<double> e_list;
-    std::vector<double> e2_list;
-    std::vector<double> x_list;
-    std::vector<double> c_list;
-    std::vector<double> U_L_list;
-    // for each temperature, use 10 different initial conditions with differnt bias
-    for(uint8_t k = 1; k < 11; k++){
-      float bias = std::exp(0.2*k);
-      std::chrono::steady_clock::time_point begin;
-      std::chrono::steady_clock::time_point end;
-      metropolis<L> metrop(beta,bias);
-      begin = std::chrono::steady_clock::now();
-      uint32_t frame_cycles = (L < 256)? 2*512/L*512/L : 10*L/256;
-      uint32_t total_cycles = (L < 32)? 50000*128/L*128/L : 12500*512/L;
-      double magnetization = metrop.run(5000,total_cycles,1,frame_cycles);
-      end = std::chrono::steady_clock::now();
-      std::cout << "run() took " << std::chrono::duration_cast<std::chrono::seconds> (end - begin).count() << " seconds:" << std::endl;
-      double susceptibility = (metrop.mean_magnetization_squared-metrop.mean_magnetization*metrop.mean_magnetization)/T*L*L;
-      double heat_capacity = (metrop.mean_energy_squared-metrop.mean_energy*metrop.mean_energy)/(T*T)*L*L;
-      double binder_cumulant = 1-metrop.mean_magnetization_fourth/(3.*metrop.mean_magnetization_squared*metrop.mean_magnetization_squared);
-      std::cout << "L = " << L << ", T = " << T << ", bias = " << bias << ": m = " << magnetization << ", m^2 = " << metrop.mean_magnetization_squared << ", e = " << metrop.mean_energy << ", e^2 = " << metrop.mean_energy_squared << ", x = " << susceptibility << ", c = " << heat_capacity << ", U_L = " << binder_cumulant << std::endl;
-      mag_list.push_back(magnetization);
-      mag2_list.push_back(metrop.mean_magnetization_squared);
-      mag4_list.push_back(metrop.mean_magnetization_fourth);
-      e_list.push_back(metrop.mean_energy);
-      e2_list.push_back(metrop.mean_energy_squared);
-      x_list.push_back(susceptibility);
-      c_list.push_back(heat_capacity);
-      U_L_list.push_back(binder_cumulant);
-      results_dist << L << "\t" << T << "\t" << bias << "\t" << magnetization << "\t" << metrop.mean_magnetization_squared << "\t" << metrop.mean_magnetization_fourth << "\t" << metrop.mean_energy << "\t" << metrop.mean_energy_squared << "\t" << susceptibility << "\t" << heat_capacity << "\t" << binder_cumulant << std::endl;
+  results_dist << "L\tT\tbias\tmag\tmag2\tmag4\te\te2\tx\tc\tU_L\txi\n";
+#ifdef DISPLAY
+  view.reset(new live_view(live_view::segment(getpid()),L));
+  std::cout << "Watch the simulation with: ./viewer " << getpid() << std::endl;
+#endif
+#ifdef METRICS
+  exporter.reset(new metrics_exporter(METRICS));
+#endif
+#ifdef CACHE
+  cache.reset(new results_cache(CACHE,CODE_VERSION));
+#endif
+#ifdef RESUME
+  journal.reset(new job_journal(results_base_filename+"_journal.dat"));
+  std::ofstream manifest(results_base_filename+"_manifest.dat",std::ofstream::out);
+  uint32_t completed = 0;
+#if defined(CAMPAIGN)
+  completed = write_manifest_of<CAMPAIGN>(manifest,temperature_list);
+#elif defined(REFINE)
+  // the refinement adds runs as it goes
+  completed = write_manifest<L>(manifest,temperature_list) + write_manifest<L/2>(manifest,temperature_list);
+#else
+  completed = write_manifest<L>(manifest,temperature_list);
+#endif
+  manifest.close();
+  std::cout << "Resuming: " << completed << " runs of the manifest are in the journal." << std::endl;
+#endif
+  results_stdev << "L\tT\tavg_mag\tstdev_mag\tavg_mag2\tstdev_mag2\tavg_mag4\tstdev_mag4\tavg_e\tstdev_e\tavg_e2\tstdev_e2\tavg_x\tstdev_x\tavg_c\tstdev_c\tavg_U_L\tstdev_U_L\tavg_xi\tstdev_xi\n";
+#if defined(CAMPAIGN)
+  campaign<CAMPAIGN>(temperature_list,results_dist,results_stdev,results_base_filename);
+#elif defined(REFINE)
+  // every round simulates the new temperatures for L and L/2 concurrently, then bisects the intervals around the peaks
+  // and crossings
+  temperature_grid grid(2,REFINE);
+  job_pool pool;
+  for(std::vector<float> next = temperature_list; !next.empty() && !shutdown_requested(); next = grid.refine()){
+    for(float T : next){
+      pool.submit([&,T]{ simulate<L>(T,results_dist,results_stdev,&grid,0); });
+      pool.submit([&,T]{ simulate<L/2>(T,results_dist,results_stdev,&grid,1); });
     }
-    std::cout << "Summary: L = " << L << ", T = " << T << ": m = " << avg(mag_list) << " +- " << stdev(mag_list) << ", e = " << avg(e_list) << " +- " << stdev(e_list) << ", x = " << avg(x_list) << " +- " << stdev(x_list) << ", c = " << avg    (c_list) << " +- " << stdev(c_list) << ", U_L = " << avg(U_L_list) << " +- " << stdev(U_L_list) << std::endl;
-    results_stdev << L << "\t" << T << "\t" << avg(mag_list) << "\t" << stdev(mag_list) << "\t" << avg(mag2_list) << "\t" << stdev(mag2_list) << "\t" << avg(mag4_list) << "\t" << stdev(mag4_list) << "\t" << avg(e_list) << "\t" << stdev(e_list) << "\t" << avg(e2_list) << "\t" << stdev(e2_list) << "\t" << avg(x_list) << "\t" << stdev(x_list) << "\t" << avg(c_list) << "\t" << stdev(c_list) << "\t" << avg(U_L_list) << "\t" << stdev(U_L_list) << std::endl;
+    pool.wait();
   }
+#else
+  // for each temperature in the list do...
+  for(uint32_t i = 0; i < temperature_list.size() && !shutdown_requested(); i++) simulate<L>(temperature_list[i],results_dist,results_stdev);
+#endif
   results_dist.close();
   results_stdev.close();
+  if(shutdown_requested()){
+    std::cout << "Shut down on signal " << shutdown_signal << ", the completed runs are in the results files" << (journal ? " and the journal." : ".") << std::endl;
+    return 128 + shutdown_signal;
+  }
 }
-
@@ -0,0 +1,332 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <fmt/format.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Monitoring of a running process in the Prometheus text format: the runs of metropolis::run() (and nfold) publish
+// their sweeps, proposals, accepted flips, flip rate, m, e and equilibration status into a fixed table of slots, the
+// job pools their queue depth and the workers (job pools and snapshot stages) their busy time into another. Every field,
+// the labels included, is a lock-free atomic written with relaxed stores by the thread that owns the slot, and the
+// exporter reads them with relaxed loads on a thread of its own, so that a scrape never waits for nor delays the
+// simulation; a scrape may mix values from before and after an update. Since a slot can be freed and claimed again while
+// it is read, every claim increments the generation of the slot, and a sample is dropped unless the slot is still
+// labelled and of the same generation after it has been read. The exporter answers every HTTP request for /metrics on a loopback TCP port
+// or on a Unix socket (curl --unix-socket path http://localhost/metrics). Slots are only claimed while an exporter runs.
+
+constexpr uint16_t metrics_run_slots = 64;                                                        // largest number of runs exported at once
+constexpr uint16_t metrics_thread_slots = 256;                                                    // largest number of threads exported at once
+
+struct run_metrics
+{
+  std::atomic<uint32_t> state;                                                                    // 0: free, 1: claimed, 2: labels written
+  std::atomic<uint32_t> generation;                                                               // number of claims of the slot
+  std::atomic<uint16_t> length;                                                                   // system length (label)
+  std::atomic<double> temperature;                                                                // temperature (label)
+  std::atomic<double> bias;                                                                       // bias of the initial state (label)
+  std::atomic<uint64_t> sweeps;                                                                   // sweeps carried out by run()
+  std::atomic<uint64_t> proposals;                                                                // spin flips proposed by run()
+  std::atomic<uint64_t> flips;                                                                    // spin flips accepted by run()
+  std::atomic<double> flip_rate;                                                                  // accepted flips per second, over the last second or so
+  std::atomic<double> magnetization;                                                              // magnetization per spin of the last snapshot
+  std::atomic<double> energy;                                                                     // energy per spin of the last snapshot
+  std::atomic<uint32_t> equilibrated;                                                             // averaging has started
+  std::atomic<uint64_t> sweeping;                                                                 // nanoseconds spent sweeping
+  std::atomic<uint64_t> updated;                                                                  // steady clock of the last update, in nanoseconds
+};
+
+struct thread_metrics
+{
+  std::atomic<uint32_t> state;                                                                    // 0: free, 1: claimed, 2: name written
+  std::atomic<uint32_t> generation;                                                               // number of claims of the slot
+  std::atomic<char> name[32];                                                                     // role and slot of the thread (label), null-terminated
+  std::atomic<uint64_t> started;                                                                  // steady clock at the start of the thread, in nanoseconds
+  std::atomic<uint64_t> busy;                                                                     // nanoseconds spent on finished jobs
+  std::atomic<uint64_t> busy_since;                                                               // steady clock at the start of the current job (0: idle)
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<double>::is_always_lock_free, "the metrics require lock-free atomics");
+
+inline std::atomic<bool> metrics_enabled(false);                                                  // an exporter runs, the slots are to be filled
+inline run_metrics metrics_runs[metrics_run_slots];                                               // slots of the runs
+inline thread_metrics metrics_threads[metrics_thread_slots];                                      // slots of the threads
+inline std::atomic<uint32_t> metrics_jobs_queued(0);                                              // jobs submitted to the job pools and not started
+inline std::atomic<uint32_t> metrics_jobs_running(0);                                             // jobs being executed by the job pools
+
+// returns the steady clock in nanoseconds
+inline uint64_t
+metrics_clock()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Claims a slot of the table for the lifetime of a run (slot stays nullptr without exporter or free slot).
+class metrics_run
+{
+  public:
+    metrics_run(uint16_t length, double temperature, double bias);                                // constructor, claims and labels a slot
+    ~metrics_run();                                                                               // destructor, frees the slot
+    run_metrics* slot;                                                                            // claimed slot (nullptr: none)
+};
+
+inline
+metrics_run::metrics_run(uint16_t length, double temperature, double bias) : slot(nullptr)
+{
+  if(!metrics_enabled.load(std::memory_order_relaxed)) return;
+  for(run_metrics& candidate : metrics_runs){
+    uint32_t expected = 0;
+    if(candidate.state.load(std::memory_order_relaxed) == 0 && candidate.state.compare_exchange_strong(expected,1)){
+      slot = &candidate;
+      break;
+    }
+  }
+  if(slot == nullptr) return;
+  // readers that see any of the new labels also see the new generation
+  slot->generation.fetch_add(1,std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->length.store(length,std::memory_order_relaxed);
+  slot->temperature.store(temperature,std::memory_order_relaxed);
+  slot->bias.store(bias,std::memory_order_relaxed);
+  for(std::atomic<uint64_t>* counter : {&slot->sweeps,&slot->proposals,&slot->flips,&slot->sweeping}) counter->store(0,std::memory_order_relaxed);
+  slot->flip_rate.store(0,std::memory_order_relaxed);
+  slot->magnetization.store(0,std::memory_order_relaxed);
+  slot->energy.store(0,std::memory_order_relaxed);
+  slot->equilibrated.store(0,std::memory_order_relaxed);
+  slot->updated.store(metrics_clock(),std::memory_order_relaxed);
+  slot->state.store(2,std::memory_order_release);
+}
+
+inline
+metrics_run::~metrics_run()
+{
+  if(slot != nullptr) slot->state.store(0,std::memory_order_release);
+}
+
+// Claims a slot of the table for the lifetime of a worker thread, which marks the jobs it executes.
+class metrics_thread
+{
+  public:
+    metrics_thread(const std::string& role);                                                      // constructor, claims a slot named <role>-<slot>
+    ~metrics_thread();                                                                            // destructor, frees the slot
+    void busy();                                                                                  // a job starts
+    void idle();                                                                                  // the job has finished
+  private:
+    thread_metrics* slot;                                                                         // claimed slot (nullptr: none)
+};
+
+inline
+metrics_thread::metrics_thread(const std::string& role) : slot(nullptr)
+{
+  if(!metrics_enabled.load(std::memory_order_relaxed)) return;
+  for(uint16_t n = 0; n < metrics_thread_slots; n++){
+    uint32_t expected = 0;
+    if(metrics_threads[n].state.load(std::memory_order_relaxed) == 0 && metrics_threads[n].state.compare_exchange_strong(expected,1)){
+      slot = &metrics_threads[n];
+      // numbered by slot rather than by thread, so that the series of short-lived threads are reused
+      char name[sizeof(slot->name)];
+      fmt::format_to_n(name,sizeof(name)-1,"{}-{}",role,n).out[0] = '\0';
+      slot->generation.fetch_add(1,std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for(size_t c = 0; c < sizeof(name); c++) slot->name[c].store(name[c],std::memory_order_relaxed);
+      break;
+    }
+  }
+  if(slot == nullptr) return;
+  slot->started.store(metrics_clock(),std::memory_order_relaxed);
+  slot->busy.store(0,std::memory_order_relaxed);
+  slot->busy_since.store(0,std::memory_order_relaxed);
+  slot->state.store(2,std::memory_order_release);
+}
+
+inline
+metrics_thread::~metrics_thread()
+{
+  if(slot != nullptr) slot->state.store(0,std::memory_order_release);
+}
+
+inline void
+metrics_thread::busy()
+{
+  if(slot != nullptr) slot->busy_since.store(metrics_clock(),std::memory_order_relaxed);
+}
+
+inline void
+metrics_thread::idle()
+{
+  if(slot == nullptr) return;
+  uint64_t since = slot->busy_since.load(std::memory_order_relaxed);
+  slot->busy.store(slot->busy.load(std::memory_order_relaxed) + metrics_clock() - since,std::memory_order_relaxed);
+  slot->busy_since.store(0,std::memory_order_relaxed);
+}
+
+// Serves the metrics on a loopback TCP port ("9100") or on a Unix socket (a path, e.g. "/tmp/ising.sock").
+class metrics_exporter
+{
+  public:
+    metrics_exporter(std::string _address);                                                       // constructor, listens on _address and enables the slots
+    ~metrics_exporter();                                                                          // destructor, stops serving
+    static std::string scrape();                                                                  // returns the current metrics in the Prometheus text format
+    std::string address;                                                                          // port or path listened on
+  private:
+    void serve();                                                                                 // answers the requests until stopped
+    int listener;                                                                                 // listening socket (-1: none)
+    std::atomic<bool> stopping;                                                                   // the server stops
+    std::thread server;                                                                           // answers the requests
+};
+
+inline
+metrics_exporter::metrics_exporter(std::string _address) : address(_address) , listener(-1) , stopping(false)
+{
+  bool local = !address.empty() && address[0] == '/';
+  listener = socket(local ? AF_UNIX : AF_INET,SOCK_STREAM,0);
+  int bound = -1;
+  if(listener >= 0 && local){
+    sockaddr_un name = {};
+    name.sun_family = AF_UNIX;
+    strncpy(name.sun_path,address.c_str(),sizeof(name.sun_path)-1);
+    unlink(name.sun_path);
+    bound = bind(listener,(sockaddr*) &name,sizeof(name));
+  }
+  else if(listener >= 0){
+    int reuse = 1;
+    setsockopt(listener,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+    sockaddr_in name = {};
+    name.sin_family = AF_INET;
+    name.sin_port = htons(atoi(address.c_str()));
+    name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bound = bind(listener,(sockaddr*) &name,sizeof(name));
+  }
+  if(bound != 0 || listen(listener,8) != 0){
+    std::cout << "Cannot listen on " << address << ", the metrics are not exported." << std::endl;
+    if(listener >= 0) close(listener);
+    listener = -1;
+    return;
+  }
+  metrics_enabled = true;
+  server = std::thread(&metrics_exporter::serve,this);
+}
+
+inline
+metrics_exporter::~metrics_exporter()
+{
+  if(listener < 0) return;
+  metrics_enabled = false;
+  stopping = true;
+  server.join();
+  close(listener);
+  if(address[0] == '/') unlink(address.c_str());
+}
+
+inline void
+metrics_exporter::serve()
+{
+  pollfd waiting = {listener,POLLIN,0};
+  while(!stopping){
+    if(poll(&waiting,1,200) <= 0) continue;
+    int client = accept(listener,nullptr,nullptr);
+    if(client < 0) continue;
+    // a client that does not send its request within a second is dropped
+    timeval timeout = {1,0};
+    setsockopt(client,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    setsockopt(client,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+    std::string request;
+    char buffer[1024];
+    while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192){
+      ssize_t received = recv(client,buffer,sizeof(buffer),0);
+      if(received <= 0) break;
+      request.append(buffer,received);
+    }
+    std::string response;
+    if(request.rfind("GET /metrics ",0) == 0 || request.rfind("GET / ",0) == 0){
+      std::string body = scrape();
+      response = fmt::format("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",body.size()) + body;
+    }
+    else response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    for(size_t sent = 0; sent < response.size();){
+      ssize_t n = send(client,response.data()+sent,response.size()-sent,MSG_NOSIGNAL);
+      if(n <= 0) break;
+      sent += n;
+    }
+    close(client);
+  }
+}
+
+inline std::string
+metrics_exporter::scrape()
+{
+  uint64_t now = metrics_clock();
+  fmt::memory_buffer out;
+  auto header = [&](const char* name, const char* type, const char* help){ fmt::format_to(std::back_inserter(out),"# HELP {} {}\n# TYPE {} {}\n",name,help,name,type); };
+  auto relaxed = [](const auto& field){ return field.load(std::memory_order_relaxed); };
+  // whether the slot still holds the labels of the given generation after it has been read
+  auto unchanged = [&](const auto& slot, uint32_t generation){
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return relaxed(slot.state) == 2 && relaxed(slot.generation) == generation;
+  };
+  // one family of samples over all published runs
+  auto runs = [&](const char* name, const char* type, const char* help, auto value){
+    header(name,type,help);
+    for(uint16_t n = 0; n < metrics_run_slots; n++){
+      const run_metrics& r = metrics_runs[n];
+      if(r.state.load(std::memory_order_acquire) != 2) continue;
+      uint32_t generation = relaxed(r.generation);
+      uint16_t length = relaxed(r.length);
+      double temperature = relaxed(r.temperature);
+      double bias = relaxed(r.bias);
+      auto sample = value(r);
+      if(!unchanged(r,generation)) continue;
+      fmt::format_to(std::back_inserter(out),"{}{{run=\"{}\",L=\"{}\",T=\"{:.4f}\",bias=\"{:.2f}\"}} {}\n",name,n,length,temperature,bias,sample);
+    }
+  };
+  runs("ising_run_sweeps","gauge","Sweeps carried out by the run.",[&](const run_metrics& r){ return relaxed(r.sweeps); });
+  runs("ising_run_proposals_total","counter","Spin flips proposed by the run.",[&](const run_metrics& r){ return relaxed(r.proposals); });
+  runs("ising_run_flips_total","counter","Spin flips accepted by the run.",[&](const run_metrics& r){ return relaxed(r.flips); });
+  runs("ising_run_flips_per_second","gauge","Accepted spin flips per second over the last second.",[&](const run_metrics& r){ return relaxed(r.flip_rate); });
+  runs("ising_run_acceptance_ratio","gauge","Accepted over proposed spin flips since the start of the run.",[&](const run_metrics& r){ uint64_t p = relaxed(r.proposals); return (p == 0) ? 0. : (double) relaxed(r.flips)/p; });
+  runs("ising_run_magnetization","gauge","Magnetization per spin of the last snapshot.",[&](const run_metrics& r){ return relaxed(r.magnetization); });
+  runs("ising_run_energy","gauge","Energy per spin of the last snapshot.",[&](const run_metrics& r){ return relaxed(r.energy); });
+  runs("ising_run_equilibrated","gauge","1 once the run averages, 0 while it equilibrates.",[&](const run_metrics& r){ return relaxed(r.equilibrated); });
+  runs("ising_run_sweeping_seconds_total","counter","Wall time spent sweeping.",[&](const run_metrics& r){ return relaxed(r.sweeping)*1e-9; });
+  runs("ising_run_idle_seconds","gauge","Seconds since the run last reported progress.",[&](const run_metrics& r){ uint64_t updated = relaxed(r.updated); return (now > updated) ? (now - updated)*1e-9 : 0.; });
+  header("ising_jobs_queued","gauge","Jobs submitted to the job pools and not started.");
+  fmt::format_to(std::back_inserter(out),"ising_jobs_queued {}\n",relaxed(metrics_jobs_queued));
+  header("ising_jobs_running","gauge","Jobs being executed by the job pools.");
+  fmt::format_to(std::back_inserter(out),"ising_jobs_running {}\n",relaxed(metrics_jobs_running));
+  header("ising_thread_busy_seconds_total","counter","Wall time the worker thread spent on jobs.");
+  std::string utilization;
+  for(const thread_metrics& t : metrics_threads){
+    if(t.state.load(std::memory_order_acquire) != 2) continue;
+    uint32_t generation = relaxed(t.generation);
+    std::string name;
+    for(const std::atomic<char>& c : t.name){
+      char character = relaxed(c);
+      if(character == '\0') break;
+      name += character;
+    }
+    uint64_t since = relaxed(t.busy_since);
+    uint64_t started = relaxed(t.started);
+    uint64_t busy_ns = relaxed(t.busy);
+    if(!unchanged(t,generation)) continue;
+    double busy = (busy_ns + ((since != 0 && now > since) ? now - since : 0))*1e-9;
+    double alive = (now > started) ? (now - started)*1e-9 : 0;
+    fmt::format_to(std::back_inserter(out),"ising_thread_busy_seconds_total{{thread=\"{}\"}} {}\n",name,busy);
+    utilization += fmt::format("ising_thread_utilization{{thread=\"{}\"}} {}\n",name,(alive > 0) ? std::min(busy/alive,1.) : 0.);
+  }
+  header("ising_thread_utilization","gauge","Fraction of its lifetime the worker thread spent on jobs.");
+  fmt::format_to(std::back_inserter(out),"{}",utilization);
+  return fmt::to_string(out);
+}
+
+#endif
@@ -14,79 +14,259 @@
 #include <chrono>
 #include "configuration.h"
 #include "avg_stdev.h"
+#include "rules.h"
+#include "couplings.h"
+#include "correlation.h"
+#include "clusters.h"
+#include "sampler.h"
+#include "jobs.h"
 #include <vector>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <atomic>
 
-template <uint16_t ARRAY_LEN>
-class metropolis: public configuration<ARRAY_LEN>
+template <uint16_t ARRAY_LEN, typename LAYOUT = row_major<ARRAY_LEN>, typename FIELDS = computed_fields<LAYOUT>, typename RULE = metropolis_rule, typename COUPLINGS = zero_field>
+class metropolis: public configuration<ARRAY_LEN,LAYOUT,FIELDS>, public sampler<ARRAY_LEN,LAYOUT,bool>
 {
+  static_assert(!COUPLINGS::anisotropic || LAYOUT::dimension == 2, "anisotropic couplings are only defined in two dimensions");
+  static_assert(!COUPLINGS::anisotropic || !FIELDS::disordered, "anisotropic couplings and quenched disorder are exclusive");
   public:
     metropolis(float _beta, float bias = 1);                                                                                 // constructor 
     metropolis(std::string _filename, float _beta, float bias = 1);                                                          // constructor with filename argument
     uint16_t* wiggle_random_spin();                                                                                          // choose a random spin and flip it if the condition is met
-    int8_t energy_change_upon_flip(uint16_t i, uint16_t j);                                                                  // return the energy change upon flipping the spin at (i,j)
-    void draw_information();                                                                                                 // display the number of cycles and magnetization
-    void datawrite();                                                                                                        // append the current magnetization and energy to the datafile
-    double run(uint32_t mincycles = 4000, uint32_t cycles = 10000, uint32_t eval_cycles = 1, uint32_t frame_cycles = 1);     // runs the Monte-Carlo simulation
-    double mean_magnetization;                                                                                               // average abolute value of the magnetization per spin
-    double mean_magnetization_squared;                                                                                       // average square of the magnetization per spin
-    double mean_magnetization_fourth;                                                                                        // average fourth power of the magnetization per spin
-    double mean_energy;                                                                                                      // average energy per spin
-    double mean_energy_squared;                                                                                              // the square of the energy per spin
+    float energy_change_upon_flip(uint16_t i, uint16_t j);                                                                   // return the energy change upon flipping the spin at (i,j)
+    float energy_change_upon_flip(uint32_t s);                                                                               // return the energy change upon flipping the spin at the site s of the layout
+    void set_couplings(float j_x, float j_y, float h = 0);                                                                   // sets the couplings and the field (as far as COUPLINGS admits them) and retabulates the acceptance
+    float get_energy();                                                                                                      // returns the energy of the current state, including couplings and field
+    float energy_of(const bool* state);                                                                                      // returns the energy of state (e.g. a snapshot), including couplings and field
+    void draw_information(cv::Mat& frame, int64_t iterations, double magnetization);                                         // display the number of cycles and magnetization in the information bar of the frame
+    void datawrite(int64_t iterations, double magnetization, double energy);                                                 // append the magnetization and energy after the given iterations to the datafile
+    void set_temporal_blocking(uint16_t _tile_rows, uint8_t _depth, uint16_t _threads = 1);                                 // use temporally blocked checkerboard sweeps instead of random-site updates
+    void blocked_sweeps(uint32_t sweeps);                                                                                    // carries out the given number of checkerboard sweeps, depth half-sweeps per tile at a time
+    void set_beta(float _beta);                                                                                              // changes the temperature and retabulates the acceptance, keeping the configuration
+    void set_correlation_function(uint32_t _correlation_cycles);                                                             // offers a snapshot to the background evaluation of G(r) every _correlation_cycles cycles of run() (0: never)
+    std::vector<double> get_correlation_function();                                                                          // returns G(r), r = 0..ARRAY_LEN/2, averaged over the snapshots of the last run()
+    void set_cluster_statistics(uint32_t _cluster_cycles, uint16_t _threads = 1);                                            // offers a snapshot to the background labelling of the geometric clusters every _cluster_cycles cycles of run() (0: never)
+    cluster_summary get_cluster_statistics();                                                                                // returns the cluster statistics, averaged over the snapshots of the last run()
+    void set_archive(uint32_t _archive_cycles);                                                                              // appends the exact state to the snapshot archive every _archive_cycles cycles of run() (0: never)
+    void set_frame_budget(double _frame_budget);                                                                             // skips video frames to keep rendering and encoding below this fraction of the wall time of run() (0: no limit)
+  protected:
+    typedef snapshot<bool,sweep_info> frame;                                                                                 // snapshot of the spins taken by run()
+    void advance(uint32_t sweeps) override;                                                                                  // carries out the given number of sweeps with the selected update scheme
+    const bool* current_state() override;                                                                                    // returns the spins, e.g. to be copied into a snapshot
+    double order_parameter(const bool* state) override;                                                                      // returns the magnetization of state
+    double energy_per_site(const bool* state) override;                                                                      // returns the energy of state, including couplings and field
+    uint8_t brightness(bool value) override;                                                                                 // returns the gray value of a spin in the live view
+    double fourier_squared() override;                                                                                       // returns the tracked |m(k)|^2 of the current state
+    void begin_run(bool counting) override;                                                                                  // resets G(r), the cluster statistics and the output of run() and resynchronizes the modes
+    void attach_stages(snapshot_pipeline<bool,sweep_info>& pipeline, std::function<bool(const frame&)> averaging, uint32_t frame_cycles) override; // attaches G(r), the cluster statistics, the datafile and video and the archive
+    void end_run(uint32_t cycle) override;                                                                                   // archives the last state and flushes the datafile
+    using sampler<ARRAY_LEN,LAYOUT,bool>::beta;                                                                              // beta (-> temperature)
+    using sampler<ARRAY_LEN,LAYOUT,bool>::iter;                                                                              // iterations carried out
+    using sampler<ARRAY_LEN,LAYOUT,bool>::flips;                                                                             // accepted flips (without overrelaxation), for the metrics
+    uint8_t acceptance_index(uint32_t s);                                                                                    // returns the index of the site s into the acceptance table
+    void tabulate();                                                                                                         // computes the acceptance table for beta and the couplings
+    COUPLINGS couplings;                                                                                                     // couplings and field of the Hamiltonian
+    double acceptance[COUPLINGS::states];                                                                                    // acceptance probability of the update rule for every acceptance index
   private:
-    float beta;                                                                                                              // beta (-> temperature)
-    int64_t iter;                                                                                                            // iterations carried out
+    void overrelax();                                                                                                        // flips every spin whose flip does not change the energy
+    uint64_t half_sweep(uint8_t color, int32_t row_begin, int32_t row_end, std::mt19937& engine);                             // updates the spins of one checkerboard color in the slabs [row_begin,row_end) (periodic), returns the accepted flips
+    void blocked_pass(uint8_t depth, uint8_t first_color);                                                                   // advances the whole lattice by depth half-sweeps, tile by tile
+    uint16_t tile_rows;                                                                                                      // number of lattice rows per tile of the blocked sweep
+    uint8_t depth;                                                                                                           // number of half-sweeps per tile while it is cache-resident (0: random-site updates)
+    uint16_t threads;                                                                                                        // number of threads working on independent tiles
+    std::unique_ptr<job_pool> tile_workers;                                                                                  // persistent workers for all threads but the sweeping one (nullptr: not started yet)
+    uint32_t batch(uint32_t sweeps) override;                                                                                // returns the sweeps to advance at once instead of the given ones, so that a blocked pass reaches its full depth
+    uint8_t next_color;                                                                                                      // checkerboard color of the next half-sweep
+    std::vector<std::mt19937> tile_rng;                                                                                      // one random number generator per tile, shared by no two threads
+    uint32_t correlation_cycles;                                                                                             // cycles between the snapshots for G(r) (0: never)
+    std::unique_ptr<pair_correlation<ARRAY_LEN,LAYOUT>> correlation;                                                         // background evaluation of G(r)
+    uint32_t cluster_cycles;                                                                                                 // cycles between the snapshots for the cluster statistics (0: never)
+    std::unique_ptr<cluster_statistics<ARRAY_LEN,LAYOUT>> clusters;                                                          // background labelling of the geometric clusters
+    double frame_budget;                                                                                                     // largest fraction of the wall time spent on video frames (0: no limit)
+    uint32_t archive_cycles;                                                                                                 // cycles between the states appended to the archive (0: never)
+    uint32_t last_written;                                                                                                   // cycle of the last line of the datafile of the current run()
+    uint32_t last_archived;                                                                                                  // cycle of the last archived state of the current run()
+    uint32_t last_snapshot;                                                                                                  // cycle of the last snapshot for G(r) of the current run()
+    uint32_t last_cluster_snapshot;                                                                                          // cycle of the last snapshot for the cluster statistics of the current run()
+    cv::Mat video_frame;                                                                                                     // frame being rendered for the video
+    uint32_t frames_written;                                                                                                 // video frames written by the current run()
+    uint32_t frames_skipped;                                                                                                 // video frames skipped for the frame budget by the current run()
+    double rendering;                                                                                                        // seconds spent on the video by the current run()
+    std::chrono::steady_clock::time_point run_begin;                                                                         // start of the current run()
 };
 
-template <uint16_t ARRAY_LEN>
-metropolis<ARRAY_LEN>::metropolis(float _beta, float bias) : configuration<ARRAY_LEN>(fmt::format("results/beta={:.4f}_N={:d}_bias={:.2f}",_beta,ARRAY_LEN,bias),bias)
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS>
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::metropolis(float _beta, float bias) : configuration<ARRAY_LEN,LAYOUT,FIELDS>(fmt::format("results/beta={:.4f}_N={:d}_bias={:.2f}",_beta,ARRAY_LEN,bias),bias) , sampler<ARRAY_LEN,LAYOUT,bool>(_beta,bias,true)
 {
-  beta = _beta;
-  iter = 0;
+  tabulate();
+  tile_rows = ARRAY_LEN;
+  depth = 0;
+  threads = 1;
+  next_color = 0;
+  correlation_cycles = 0;
+  cluster_cycles = 0;
+  frame_budget = 0;
+  archive_cycles = 0;
 }
 
-template <uint16_t ARRAY_LEN>
-metropolis<ARRAY_LEN>::metropolis(std::string _filename, float _beta, float bias) : configuration<ARRAY_LEN>(_filename,bias)
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS>
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::metropolis(std::string _filename, float _beta, float bias) : configuration<ARRAY_LEN,LAYOUT,FIELDS>(_filename,bias) , sampler<ARRAY_LEN,LAYOUT,bool>(_beta,bias,!_filename.empty())
 {
-  beta = _beta;
-  iter = 0;
+  tabulate();
+  tile_rows = ARRAY_LEN;
+  depth = 0;
+  threads = 1;
+  next_color = 0;
+  correlation_cycles = 0;
+  cluster_cycles = 0;
+  frame_budget = 0;
+  archive_cycles = 0;
 }
 
-template <uint16_t ARRAY_LEN> void
-metropolis<ARRAY_LEN>::draw_information()
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::draw_information(cv::Mat& frame, int64_t iterations, double magnetization)
 {
-  if(ARRAY_LEN >= 200){
-    cv::putText(this->bgr, "iter = ", cv::Point(ARRAY_LEN/100,ARRAY_LEN+ARRAY_LEN/17), cv::FONT_HERSHEY_DUPLEX, (float) ARRAY_LEN/500., cv::Scalar(255,0,0), ARRAY_LEN/200);
-    cv::putText(this->bgr, fmt::format("{:.0f}", (float) iter/(((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN))), cv::Point(ARRAY_LEN/4.54,ARRAY_LEN+ARRAY_LEN/17), cv::FONT_HERSHEY_DUPLEX, (float) ARRAY_LEN/500., cv::Scalar(255,0,0), ARRAY_LEN/200);
-    cv::putText(this->bgr, "m = ", cv::Point(ARRAY_LEN/2+5,ARRAY_LEN+ARRAY_LEN/17), cv::FONT_HERSHEY_DUPLEX, (float) ARRAY_LEN/500., cv::Scalar(255,0,0), ARRAY_LEN/200);
-    cv::putText(this->bgr, fmt::format("{:.4f}", this->get_magnetization()), cv::Point(ARRAY_LEN/2+ARRAY_LEN/5.5,ARRAY_LEN+ARRAY_LEN/17), cv::FONT_HERSHEY_DUPLEX, (float) ARRAY_LEN/500., cv::Scalar(255,0,0), ARRAY_LEN/200);
+  // the information bar is as wide as the (possibly cropped and downsampled) frame
+  int n = frame.cols;
+  if(n >= 200){
+    cv::putText(frame, "iter = ", cv::Point(n/100,n+n/17), cv::FONT_HERSHEY_DUPLEX, (float) n/500., cv::Scalar(255,0,0), n/200);
+    cv::putText(frame, fmt::format("{:.0f}", (float) iterations/LAYOUT::volume), cv::Point(n/4.54,n+n/17), cv::FONT_HERSHEY_DUPLEX, (float) n/500., cv::Scalar(255,0,0), n/200);
+    cv::putText(frame, "m = ", cv::Point(n/2+5,n+n/17), cv::FONT_HERSHEY_DUPLEX, (float) n/500., cv::Scalar(255,0,0), n/200);
+    cv::putText(frame, fmt::format("{:.4f}", magnetization), cv::Point(n/2+n/5.5,n+n/17), cv::FONT_HERSHEY_DUPLEX, (float) n/500., cv::Scalar(255,0,0), n/200);
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> float
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::energy_change_upon_flip(uint16_t i, uint16_t j){
+  return energy_change_upon_flip(LAYOUT::site(i,j));
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> float
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::energy_change_upon_flip(uint32_t s){
+  return couplings.energy_change(acceptance_index(s),LAYOUT::coordination,FIELDS::disordered);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> uint8_t
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::acceptance_index(uint32_t s){
+  if constexpr (COUPLINGS::anisotropic){
+    return 3 * this->local_state(s) + this->get_spin(LAYOUT::neighbour(s,0)) + this->get_spin(LAYOUT::neighbour(s,1));
+  }
+  else{
+    return this->local_state(s);
   }
 }
 
-template <uint16_t ARRAY_LEN> int8_t
-metropolis<ARRAY_LEN>::energy_change_upon_flip(uint16_t i, uint16_t j){
-  return 2 * (-!this->get_spin(i,j) + this->get_spin(i,j)) * (-4. + 2. * (this->get_spin(this->idx(i-1),j) + this->get_spin(this->idx(i+1),j) + this->get_spin(i,this->idx(j-1)) + this->get_spin(i,this->idx(j+1)) ) );
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::tabulate(){
+  for(uint8_t index = 0; index < COUPLINGS::states; index++) acceptance[index] = RULE::probability(beta,couplings.energy_change(index,LAYOUT::coordination,FIELDS::disordered));
 }
 
-template <uint16_t ARRAY_LEN> void
-metropolis<ARRAY_LEN>::datawrite()
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_correlation_function(uint32_t _correlation_cycles){
+  correlation_cycles = _correlation_cycles;
+  if(correlation_cycles > 0 && !correlation) correlation.reset(new pair_correlation<ARRAY_LEN,LAYOUT>());
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> std::vector<double>
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::get_correlation_function(){
+  return correlation ? correlation->result() : std::vector<double>();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_cluster_statistics(uint32_t _cluster_cycles, uint16_t _threads){
+  cluster_cycles = _cluster_cycles;
+  if(cluster_cycles > 0 && !clusters) clusters.reset(new cluster_statistics<ARRAY_LEN,LAYOUT>(_threads));
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> cluster_summary
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::get_cluster_statistics(){
+  return clusters ? clusters->result() : cluster_summary();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_archive(uint32_t _archive_cycles){
+  archive_cycles = _archive_cycles;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_frame_budget(double _frame_budget){
+  frame_budget = _frame_budget;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_beta(float _beta){
+  beta = _beta;
+  tabulate();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_couplings(float j_x, float j_y, float h){
+  if constexpr (COUPLINGS::anisotropic){
+    couplings.j_x = j_x;
+    couplings.j_y = j_y;
+  }
+  if constexpr (COUPLINGS::field) couplings.h = h;
+  tabulate();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> float
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::get_energy(){
+  return energy_of(this->spins());
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> float
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::energy_of(const bool* state){
+  if constexpr (!COUPLINGS::anisotropic){
+    float energy = configuration<ARRAY_LEN,LAYOUT,FIELDS>::energy_of(state);
+    if constexpr (COUPLINGS::field) energy -= couplings.h * this->magnetization_of(state);
+    return energy;
+  }
+  else{
+    double sum = 0;
+    for(uint32_t s = 0; s < LAYOUT::volume; s++){
+      int8_t spin = -1 + 2 * state[s];
+      sum += spin * (couplings.j_y * (-1 + 2 * state[LAYOUT::neighbour(s,1)]) + couplings.j_x * (-1 + 2 * state[LAYOUT::neighbour(s,3)]) + couplings.h);
+    }
+    return -((float) sum)/LAYOUT::volume;
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::datawrite(int64_t iterations, double magnetization, double energy)
 {
-  this->datafile << fmt::format("{:.2f}",(float) this->iter/(((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN))) << "\t" << fmt::format("{:.6f}",this->get_magnetization()) <<  "\t" << fmt::format("{:.6f}",this->get_energy()) << std::endl;
+  this->datafile << fmt::format("{:.2f}",(float) iterations/LAYOUT::volume) << "\t" << fmt::format("{:.6f}",magnetization) <<  "\t" << fmt::format("{:.6f}",energy) << std::endl;
 }
 
-template < uint16_t ARRAY_LEN > uint16_t*
-metropolis<ARRAY_LEN>::wiggle_random_spin(){
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> uint16_t*
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::wiggle_random_spin(){
   std::chrono::steady_clock::time_point begin;
   std::chrono::steady_clock::time_point end;
   D(begin = std::chrono::steady_clock::now());
-  uint16_t i = this->int_distribution(this->rng);
-  uint16_t j = this->int_distribution(this->rng);
-  int8_t energy_change = energy_change_upon_flip(i,j);
-  if(energy_change <= 0){
-    this->invert_spin(i,j);
+  uint16_t i, j;
+  uint32_t s;
+  if constexpr (LAYOUT::dimension == 2){
+    i = this->int_distribution(this->rng);
+    j = this->int_distribution(this->rng);
+    s = LAYOUT::site(i,j);
+  }
+  else{
+    s = this->site_distribution(this->rng);
+    i = LAYOUT::row(s);
+    j = LAYOUT::col(s);
+  }
+  double probability = acceptance[acceptance_index(s)];
+  if(probability >= 1.){
+    this->invert_spin(s);
+    flips++;
   } 
   else{
     double rnd = this->real_distribution(this->rng);
-    if(rnd < exp(-beta*energy_change)) this->invert_spin(i,j);
+    if(rnd < probability){
+      this->invert_spin(s);
+      flips++;
+    }
   } 
   uint16_t* out = new uint16_t[2];
   out[0] = i;
@@ -97,67 +277,225 @@ metropolis<ARRAY_LEN>::wiggle_random_spin(){
   return out;
 }
 
-template <uint16_t ARRAY_LEN> double 
-metropolis<ARRAY_LEN>::run(uint32_t mincycles, uint32_t cycles, uint32_t eval_cycles, uint32_t frame_cycles){
-  uint32_t k = 0;
-  uint32_t cycle = 0;
-  int32_t counter = 0;
-  this->gray2bgr();
-  this->draw_information();
-  this->imshow();
-  this->vidwrite();
-  this->datawrite();
-  bool start_averaging = false;
-  uint32_t initial_cycle = 0;
-  uint16_t averaging_over = (eval_cycles > 1)? 1000/eval_cycles : 1000;
-  std::vector<double> indices;
-  std::vector<double> last_magnetization_values;
-  char key = 0;
-  uint32_t last_frame = 0;
-  while(key != 27 && cycle*start_averaging < initial_cycle + cycles)
-  {
-    for(uint32_t i = 0; i < eval_cycles*((uint32_t) ARRAY_LEN)*((uint32_t) ARRAY_LEN); i++){
-      uint16_t* ptr = this->wiggle_random_spin();
-      delete[] ptr;
-    }
-    cycle = iter/(((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN));
-    double magnetization = this->get_magnetization();
-    double energy = this->get_energy();
-    last_magnetization_values.push_back(magnetization);
-    indices.push_back(((double) iter)/(((uint32_t) ARRAY_LEN) * ((uint32_t) ARRAY_LEN)));
-    if(k > averaging_over)
-    {
-      last_magnetization_values.erase(last_magnetization_values.begin());
-      indices.erase(indices.begin());
-      if(!start_averaging && std::abs(slope(indices,last_magnetization_values)) < 0.000001 && cycle > mincycles)
-      {
-        std::cout << "Target slope " << std::abs(slope(indices,last_magnetization_values)) << " reached at " << cycle << "." << std::endl;
-        start_averaging = true;
-        initial_cycle = cycle;
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_temporal_blocking(uint16_t _tile_rows, uint8_t _depth, uint16_t _threads)
+{
+  // the tiles must be at least 2*depth rows high, such that the trapezoids of neighbouring tiles do not overlap
+  depth = std::min<uint16_t>(_depth,ARRAY_LEN/2);
+  tile_rows = std::max<uint16_t>(_tile_rows,2*depth);
+  // cached local fields are updated without synchronization, and the tiles update the fields of their neighbours' rows
+  tile_rng.clear();
+  for(uint16_t k = 0; k < std::max(ARRAY_LEN/tile_rows,1); k++) tile_rng.emplace_back(this->rng());
+  // more threads than tiles would idle
+  threads = FIELDS::cached ? 1 : std::min<uint16_t>(std::max<uint16_t>(_threads,1),tile_rng.size());
+  tile_workers.reset();
+}
+
+// A blocked pass of depth half-sweeps needs depth/2 sweeps at once; overrelaxation interleaves sweep by sweep anyway.
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> uint32_t
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::batch(uint32_t sweeps)
+{
+  if(depth <= 2 || RULE::overrelaxation) return sweeps;
+  return std::max<uint32_t>(sweeps,(depth+1)/2);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> uint64_t
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::half_sweep(uint8_t color, int32_t row_begin, int32_t row_end, std::mt19937& engine)
+{
+  std::uniform_real_distribution<double> distribution(0.0,1.0);
+  uint64_t accepted = 0;
+  for(int32_t r = row_begin; r < row_end; r++){
+    uint16_t i = this->idx(r);
+    for(uint32_t line = 0; line < LAYOUT::lines; line++){
+      for(uint16_t j = (i + LAYOUT::line_parity(line) + color) % 2; j < ARRAY_LEN; j += 2){
+        uint32_t s = LAYOUT::slab_site(i,line,j);
+        double probability = acceptance[acceptance_index(s)];
+        if(probability >= 1. || distribution(engine) < probability){
+          this->invert_spin(s,false);
+          accepted++;
+        }
       }
     }
-    if(start_averaging){
-      mean_magnetization = (counter == 0) ? std::abs(magnetization) : (mean_magnetization*counter + std::abs(magnetization))/(counter+1);
-      mean_magnetization_squared = (counter == 0) ? magnetization*magnetization : (mean_magnetization_squared*counter + magnetization*magnetization)/(counter+1);
-      mean_magnetization_fourth = (counter == 0) ? magnetization*magnetization*magnetization*magnetization : (mean_magnetization_fourth*counter + magnetization*magnetization*magnetization*magnetization)/(counter+1);
-      mean_energy = (counter == 0) ? energy : (mean_energy*counter + energy)/(counter+1);
-      mean_energy_squared = (counter == 0) ? energy*energy : (mean_energy_squared*counter + energy*energy)/(counter+1);
-      counter++;
+  }
+  return accepted;
+}
+
+// Temporal blocking on a periodic stack of tiles of tile_rows rows. A half-sweep of one color only reads the spins of
+// the other color, hence step t may update a row once its two neighbouring rows have completed step t-1. In the first
+// phase, every tile [a,b) carries out step t on the shrinking trapezoid [a+t,b-t); the tiles are independent because
+// a tile only reads the outermost row of its neighbour at step 0, which the neighbour itself only touches at step 0 in
+// the other color. In the second phase, the inverted trapezoids [a-t,a+t) around every tile boundary a complete the
+// missing rows. Both phases are distributed among the threads tile by tile: the sweeping thread takes the first share,
+// persistent workers the others. In more than two dimensions, a row is a slab of the lattice (see layout.h), so that the
+// tiles are stacks of slabs.
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::blocked_pass(uint8_t pass_depth, uint8_t first_color)
+{
+  static_assert(ARRAY_LEN % 2 == 0, "checkerboard sweeps require an even system length");
+  uint16_t tiles = tile_rng.size();
+  auto tile_begin = [&](uint16_t k){ return (int32_t) k*tile_rows; };
+  auto tile_end = [&](uint16_t k){ return (k == tiles-1) ? (int32_t) ARRAY_LEN : (int32_t) (k+1)*tile_rows; };
+  // every thread counts its accepted flips locally and adds them once per phase
+  std::atomic<uint64_t> accepted(0);
+  auto trapezoids = [&](uint16_t n){
+    uint64_t local = 0;
+    for(uint16_t k = n; k < tiles; k += threads){
+      for(uint8_t t = 0; t < pass_depth; t++) local += half_sweep((first_color+t)%2,tile_begin(k)+t,tile_end(k)-t,tile_rng[k]);
+    }
+    accepted += local;
+  };
+  auto inverted_trapezoids = [&](uint16_t n){
+    uint64_t local = 0;
+    for(uint16_t k = n; k < tiles; k += threads){
+      for(uint8_t t = 1; t < pass_depth; t++) local += half_sweep((first_color+t)%2,tile_begin(k)-t,tile_begin(k)+t,tile_rng[k]);
     }
-    if(cycle >= last_frame + frame_cycles){
-      this->gray2bgr();
-      this->draw_information();
-      this->imshow();
-      this->datawrite();
-      this->vidwrite();
-      last_frame = cycle;
-      key = cv::waitKey(1);
+    accepted += local;
+  };
+  auto distribute = [&](const std::function<void(uint16_t)>& phase){
+    if(threads == 1){
+      phase(0);
+      return;
+    }
+    if(!tile_workers) tile_workers.reset(new job_pool(threads-1,"tiles"));
+    for(uint16_t n = 1; n < threads; n++) tile_workers->submit([&phase,n]{ phase(n); });
+    phase(0);
+    tile_workers->wait();
+  };
+  distribute(trapezoids);
+  distribute(inverted_trapezoids);
+  iter += ((int64_t) pass_depth)*LAYOUT::volume/2;
+  flips += accepted;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::blocked_sweeps(uint32_t sweeps)
+{
+  if(tile_rng.empty()) tile_rng.emplace_back(this->rng());
+  for(uint64_t remaining = 2*((uint64_t) sweeps); remaining > 0;){
+    uint8_t pass_depth = std::min<uint64_t>(std::max<uint8_t>(depth,1),remaining);
+    blocked_pass(pass_depth,next_color);
+    next_color = (next_color + pass_depth) % 2;
+    remaining -= pass_depth;
+  }
+  // the tiles flip concurrently, hence the modes are not tracked flip by flip
+  this->compute_modes();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::advance(uint32_t sweeps)
+{
+  // overrelaxation sweeps interleave with the update sweeps one by one
+  uint32_t chunk = RULE::overrelaxation ? 1 : sweeps;
+  for(uint32_t n = 0; n < sweeps; n += chunk){
+    if(depth > 0){
+      blocked_sweeps(chunk);
+    }
+    else{
+      for(uint32_t i = 0; i < chunk*LAYOUT::volume; i++){
+        uint16_t* ptr = this->wiggle_random_spin();
+        delete[] ptr;
+      }
     }
-    k++;
+    if(RULE::overrelaxation) overrelax();
   }
-  this->destroyWindow();
-  this->vidrelease();
-  this->datafile.close();
-  return mean_magnetization;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::overrelax()
+{
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    if(energy_change_upon_flip(s) == 0) this->invert_spin(s);
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> const bool*
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::current_state(){
+  return this->spins();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> double
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::order_parameter(const bool* state){
+  return this->magnetization_of(state);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> double
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::energy_per_site(const bool* state){
+  return energy_of(state);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> uint8_t
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::brightness(bool value){
+  return value*255;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> double
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::fourier_squared(){
+  return this->get_fourier_squared();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::begin_run(bool counting){
+  // the tile workers are started anew under the counters, which they inherit
+  if(counting) tile_workers.reset();
+  // G(r) and the cluster statistics describe this run only, also when a chain is carried over (annealing)
+  if(correlation) correlation->reset();
+  if(clusters) clusters->reset();
+  // resynchronizes the incrementally updated modes, which accumulate rounding errors
+  this->compute_modes();
+  last_written = 0;
+  last_archived = 0;
+  last_snapshot = 0;
+  last_cluster_snapshot = 0;
+  frames_written = 0;
+  frames_skipped = 0;
+  rendering = 0;
+  run_begin = std::chrono::steady_clock::now();
+}
+
+// G(r), the cluster statistics, the datafile and the video (every frame_cycles cycles, the video only within the frame
+// budget) and the archive are taken from the snapshots of run(). The stages only read the bonds and vacancies and the
+// couplings, which do not change during run().
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::attach_stages(snapshot_pipeline<bool,sweep_info>& pipeline, std::function<bool(const frame&)> averaging, uint32_t frame_cycles){
+  if(correlation_cycles > 0) pipeline.attach("correlation",[this,averaging](const frame& f){
+    if(!averaging(f) || f.info.cycle < last_snapshot + correlation_cycles) return;
+    correlation->evaluate([&](uint32_t s){ return this->sign_of(f.sites,s); });
+    last_snapshot = f.info.cycle;
+  });
+  if(cluster_cycles > 0) pipeline.attach("clusters",[this,averaging](const frame& f){
+    if(!averaging(f) || f.info.cycle < last_cluster_snapshot + cluster_cycles) return;
+    clusters->evaluate([&](uint32_t s){ return this->sign_of(f.sites,s); });
+    last_cluster_snapshot = f.info.cycle;
+  });
+  if(this->recording) pipeline.attach("output",[this,frame_cycles](const frame& f){
+    if(f.info.cycle > 0 && f.info.cycle < last_written + frame_cycles) return;
+    double magnetization = this->magnetization_of(f.sites);
+    datawrite(f.info.iter,magnetization,energy_of(f.sites));
+    last_written = f.info.cycle;
+    // the cadence of the video adapts to the time a frame takes, the datafile keeps every frame_cycles
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    if(frame_budget > 0 && rendering > frame_budget*std::chrono::duration<double>(begin - run_begin).count()){
+      frames_skipped++;
+      return;
+    }
+    this->render(f.sites,video_frame);
+    draw_information(video_frame,f.info.iter,magnetization);
+    this->vidwrite(video_frame);
+    rendering += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    frames_written++;
+  });
+  if(this->recording && archive_cycles > 0) pipeline.attach("archive",[this](const frame& f){
+    if(f.info.cycle > 0 && f.info.cycle < last_archived + archive_cycles) return;
+    this->archive_write(f.sites,((double) f.info.iter)/LAYOUT::volume);
+    last_archived = f.info.cycle;
+  });
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::end_run(uint32_t cycle){
+  // the last state is always archived, as a checkpoint to restart from
+  if(this->recording && archive_cycles > 0 && last_archived != cycle) this->archive_write(this->spins(),((double) iter)/LAYOUT::volume);
+  if(this->recording) std::cout << fmt::format("Video: {} frames written in {:.2f} s, {} skipped for the frame budget.",frames_written,rendering,frames_skipped) << std::endl;
+  this->datafile.flush();
 }
 #endif
@@ -0,0 +1,87 @@
+#ifndef MODELS_H
+#define MODELS_H
+
+#include <cstdint>
+#include <math.h>
+#include <algorithm>
+
+// A model is the energy stencil of a q-state spin system with nearest-neighbour bonds, H = sum over bonds of
+// bond_energy(s_i,s_j). It also provides the reflections used by the Wolff cluster update: involutions of the states
+// that leave every bond energy invariant when applied to both ends. If all bond energies are multiples of 1/quantum,
+// the engines tabulate the acceptance per energy change (quantum = 0: not quantized, the acceptance is computed per
+// proposal).
+
+// q-state Potts model: H = -sum delta(s_i,s_j). The transition is continuous for q <= 4 and first order for q > 4 in
+// two dimensions, at T_c = 1/ln(1+sqrt(q)). potts_model<2> is the Ising model at twice the temperature.
+template <uint8_t Q>
+struct potts_model
+{
+  static_assert(Q >= 2, "the Potts model requires at least two states");
+  static constexpr uint8_t states = Q;                                                  // number of states per site
+  static constexpr uint8_t quantum = 1;                                                 // bond energies are integers
+  static constexpr uint8_t reflections = Q - 1;                                         // number of reflections per seed state
+  static constexpr bool diagonal = true;                                                // bond energies only depend on whether the states agree
+  static float bond_energy(uint8_t a, uint8_t b);                                       // returns -delta(a,b)
+  static uint8_t reflect(uint8_t s, uint8_t seed, uint8_t r);                           // swaps the seed state with the r-th other state
+  static double order_parameter(const uint32_t* counts, uint32_t volume);               // returns (q*max fraction - 1)/(q-1)
+};
+
+template <uint8_t Q> float
+potts_model<Q>::bond_energy(uint8_t a, uint8_t b)
+{
+  return -(float) (a == b);
+}
+
+template <uint8_t Q> uint8_t
+potts_model<Q>::reflect(uint8_t s, uint8_t seed, uint8_t r)
+{
+  uint8_t other = (seed + 1 + r) % Q;
+  return (s == seed) ? other : (s == other) ? seed : s;
+}
+
+template <uint8_t Q> double
+potts_model<Q>::order_parameter(const uint32_t* counts, uint32_t volume)
+{
+  return (Q*((double) *std::max_element(counts,counts+Q))/volume-1.)/(Q-1.);
+}
+
+// q-state clock model: planar spins at the angles 2*pi*s/q, H = -sum cos(2*pi*(s_i-s_j)/q). For q <= 4 it is in the
+// Ising universality class, for q > 4 it has two Berezinskii-Kosterlitz-Thouless transitions in two dimensions.
+template <uint8_t Q>
+struct clock_model
+{
+  static_assert(Q >= 2, "the clock model requires at least two states");
+  static constexpr uint8_t states = Q;                                                  // number of states per site
+  static constexpr uint8_t quantum = (Q == 2 || Q == 4) ? 1 : (Q == 3 || Q == 6) ? 2 : 0; // cosines of multiples of 2*pi/q are multiples of 1/quantum
+  static constexpr uint8_t reflections = Q;                                             // number of reflection axes
+  static constexpr bool diagonal = false;                                               // bond energies depend on the angle between the states
+  static float bond_energy(uint8_t a, uint8_t b);                                       // returns -cos(2*pi*(a-b)/q)
+  static uint8_t reflect(uint8_t s, uint8_t seed, uint8_t r);                           // reflects the angle at the axis pi*r/q
+  static double order_parameter(const uint32_t* counts, uint32_t volume);               // returns the length of the mean spin vector
+};
+
+template <uint8_t Q> float
+clock_model<Q>::bond_energy(uint8_t a, uint8_t b)
+{
+  return -cos(2.*M_PI*(a-b)/Q);
+}
+
+template <uint8_t Q> uint8_t
+clock_model<Q>::reflect(uint8_t s, uint8_t, uint8_t r)
+{
+  return (r + Q - s) % Q;
+}
+
+template <uint8_t Q> double
+clock_model<Q>::order_parameter(const uint32_t* counts, uint32_t volume)
+{
+  double x = 0;
+  double y = 0;
+  for(uint8_t s = 0; s < Q; s++){
+    x += counts[s]*cos(2.*M_PI*s/Q);
+    y += counts[s]*sin(2.*M_PI*s/Q);
+  }
+  return sqrt(x*x+y*y)/volume;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef MULTISPIN_H
+#define MULTISPIN_H
+
+#include <fmt/core.h>
+#include <string>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <vector>
+#include "layout.h"
+#include "avg_stdev.h"
+#include "shutdown.h"
+
+// Asynchronous multi-spin coding: bit k of every lattice word belongs to replica k, so that one bitwise update advances
+// 64 independent Markov chains at the same site. Every replica draws its own random bits for the acceptance, hence the
+// chains are statistically independent; they only share the order in which the sites are visited.
+
+template <uint16_t ARRAY_LEN, typename LAYOUT = row_major<ARRAY_LEN>>
+class multispin
+{
+  public:
+    static constexpr uint8_t replicas = 64;                                                                                  // number of replicas packed into one word
+    multispin(float _beta, std::vector<float> biases);                                                                       // constructor, replica k starts from a lattice with bias biases[k % biases.size()]
+    bool get_spin(uint8_t replica, uint16_t i, uint16_t j);                                                                  // returns the state of the spin at position (i,j) of the given replica
+    void sweep();                                                                                                            // visits every site once, updating all replicas at once
+    void get_magnetization(double* magnetization);                                                                           // writes the magnetization per spin of every replica into magnetization[64]
+    void get_energy(double* energy);                                                                                         // writes the energy per spin of every replica into energy[64]
+    void run(uint32_t mincycles = 4000, uint32_t cycles = 10000, uint32_t eval_cycles = 1);                                  // runs the Monte-Carlo simulation of all replicas
+    double mean_magnetization[replicas];                                                                                     // average abolute value of the magnetization per spin
+    double mean_magnetization_squared[replicas];                                                                             // average square of the magnetization per spin
+    double mean_magnetization_fourth[replicas];                                                                              // average fourth power of the magnetization per spin
+    double mean_energy[replicas];                                                                                            // average energy per spin
+    double mean_energy_squared[replicas];                                                                                    // the square of the energy per spin
+    bool interrupted;                                                                                                        // the last run() was stopped early by a signal (see shutdown.h)
+    uint32_t samples;                                                                                                        // number of measurements averaged by the last run()
+  private:
+    uint64_t bernoulli_mask(uint64_t threshold);                                                                             // returns a word whose bits are set independently with probability threshold/2^64
+    void count_bits(const std::vector<uint64_t>& words, uint64_t* counts);                                                   // adds the number of set bits of every replica to counts[64]
+    static void transpose(uint64_t* block);                                                                                  // transposes the 64x64 bit matrix block[64]
+    std::mt19937_64 rng;                                                                                                     // 64-bit Mersenne Twister pseudo-random generator
+    std::vector<uint64_t> spin;                                                                                              // state of the 64 spinsystems, ordered by the layout
+    uint64_t acceptance;                                                                                                     // exp(-4*beta) in units of 2^-64
+    float beta;                                                                                                              // beta (-> temperature)
+    int64_t iter;                                                                                                            // sweeps carried out
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT>
+multispin<ARRAY_LEN,LAYOUT>::multispin(float _beta, std::vector<float> biases) : rng(std::random_device{}()) , spin(LAYOUT::volume,0)
+{
+  beta = _beta;
+  iter = 0;
+  interrupted = false;
+  samples = 0;
+  acceptance = (exp(-4.*beta) >= 1.) ? ~0ull : (uint64_t) ldexp(exp(-4.*beta),64);
+  for(uint8_t k = 0; k < replicas; k++){
+    std::uniform_real_distribution<float> biased_distribution(0.0,1.+1./biases[k % biases.size()]);
+    for(uint32_t s = 0; s < LAYOUT::volume; s++){
+      spin[s] |= ((uint64_t) (int) biased_distribution(rng)) << k;
+    }
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> bool
+multispin<ARRAY_LEN,LAYOUT>::get_spin(uint8_t replica, uint16_t i, uint16_t j)
+{
+  return (spin[LAYOUT::site(i,j)] >> replica) & 1;
+}
+
+// Compares the binary expansion of an independent uniform random number per replica with the threshold, starting from
+// the most significant bit. A replica is decided at the first bit where the two differ, so only about log2(64)+2 random
+// words are needed on average.
+template <uint16_t ARRAY_LEN, typename LAYOUT> uint64_t
+multispin<ARRAY_LEN,LAYOUT>::bernoulli_mask(uint64_t threshold)
+{
+  uint64_t result = 0;
+  uint64_t undecided = ~0ull;
+  for(int8_t b = 63; b >= 0 && undecided; b--){
+    uint64_t r = rng();
+    if((threshold >> b) & 1){
+      result |= undecided & ~r;
+      undecided &= r;
+    }
+    else{
+      undecided &= ~r;
+    }
+  }
+  return result;
+}
+
+// With a the number of antiparallel neighbours, the energy change upon flipping is 8-4a: flips with a >= 2 are always
+// accepted, flips with a = 1 with probability exp(-4*beta) and flips with a = 0 with probability exp(-8*beta), which is
+// realised as the product of two independent masks of probability exp(-4*beta). For a general coordination z, the
+// energy change is 2z-4a, the flip is accepted with probability exp(-4*beta)^(z/2-a), and a is counted per replica in a
+// bit-sliced adder.
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+multispin<ARRAY_LEN,LAYOUT>::sweep()
+{
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    uint64_t flip;
+    if constexpr (LAYOUT::coordination == 4){
+      uint64_t x0 = spin[s] ^ spin[LAYOUT::neighbour(s,0)];
+      uint64_t x1 = spin[s] ^ spin[LAYOUT::neighbour(s,1)];
+      uint64_t x2 = spin[s] ^ spin[LAYOUT::neighbour(s,2)];
+      uint64_t x3 = spin[s] ^ spin[LAYOUT::neighbour(s,3)];
+      uint64_t at_least_two = (x0 & x1) | (x2 & x3) | ((x0 | x1) & (x2 | x3));
+      uint64_t none = ~(x0 | x1 | x2 | x3);
+      uint64_t exactly_one = ~at_least_two & ~none;
+      flip = at_least_two;
+      if(~at_least_two){
+        uint64_t accept = bernoulli_mask(acceptance);
+        flip |= exactly_one & accept;
+        if(none & accept) flip |= none & accept & bernoulli_mask(acceptance);
+      }
+    }
+    else{
+      static_assert(LAYOUT::coordination < 16, "the bit-sliced counter holds at most 15 neighbours");
+      uint64_t count[4] = {0};
+      for(uint8_t k = 0; k < LAYOUT::coordination; k++){
+        uint64_t carry = spin[s] ^ spin[LAYOUT::neighbour(s,k)];
+        for(uint8_t b = 0; b < 4 && carry; b++){
+          uint64_t next = count[b] & carry;
+          count[b] ^= carry;
+          carry = next;
+        }
+      }
+      uint64_t equal[LAYOUT::coordination/2];
+      uint64_t below = 0;
+      for(uint8_t a = 0; a < LAYOUT::coordination/2; a++){
+        equal[a] = ~0ull;
+        for(uint8_t b = 0; b < 4; b++) equal[a] &= ((a >> b) & 1) ? count[b] : ~count[b];
+        below |= equal[a];
+      }
+      flip = ~below;
+      uint64_t accept = ~0ull;
+      for(int8_t a = LAYOUT::coordination/2 - 1; a >= 0 && (below & accept); a--){
+        accept &= bernoulli_mask(acceptance);
+        flip |= equal[a] & accept;
+        below &= ~equal[a];
+      }
+    }
+    spin[s] ^= flip;
+  }
+  iter++;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+multispin<ARRAY_LEN,LAYOUT>::transpose(uint64_t* block)
+{
+  uint64_t m = 0x00000000FFFFFFFFull;
+  for(uint8_t j = 32; j != 0; j >>= 1, m ^= (m << j)){
+    for(uint8_t k = 0; k < 64; k = ((k | j) + 1) & ~j){
+      uint64_t t = ((block[k] >> j) ^ block[k | j]) & m;
+      block[k] ^= t << j;
+      block[k | j] ^= t;
+    }
+  }
+}
+
+// Transposes blocks of 64 words, such that every word holds 64 sites of a single replica, and counts them with popcount.
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+multispin<ARRAY_LEN,LAYOUT>::count_bits(const std::vector<uint64_t>& words, uint64_t* counts)
+{
+  uint64_t block[64];
+  uint32_t s = 0;
+  for(; s + 64 <= words.size(); s += 64){
+    std::copy(words.begin()+s,words.begin()+s+64,block);
+    transpose(block);
+    for(uint8_t k = 0; k < replicas; k++) counts[k] += __builtin_popcountll(block[k]);
+  }
+  for(; s < words.size(); s++){
+    for(uint8_t k = 0; k < replicas; k++) counts[k] += (words[s] >> k) & 1;
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+multispin<ARRAY_LEN,LAYOUT>::get_magnetization(double* magnetization)
+{
+  uint64_t counts[replicas] = {0};
+  count_bits(spin,counts);
+  for(uint8_t k = 0; k < replicas; k++) magnetization[k] = -1.+2.*((double) counts[k])/LAYOUT::volume;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+multispin<ARRAY_LEN,LAYOUT>::get_energy(double* energy)
+{
+  uint64_t counts[replicas] = {0};
+  std::vector<uint64_t> aligned(LAYOUT::volume);
+  for(uint8_t k = 1; k < LAYOUT::coordination; k += 2){
+    for(uint32_t s = 0; s < LAYOUT::volume; s++) aligned[s] = ~(spin[s] ^ spin[LAYOUT::neighbour(s,k)]);
+    count_bits(aligned,counts);
+  }
+  for(uint8_t k = 0; k < replicas; k++) energy[k] = -(2.*((double) counts[k])/LAYOUT::volume-LAYOUT::dimension);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT> void
+multispin<ARRAY_LEN,LAYOUT>::run(uint32_t mincycles, uint32_t cycles, uint32_t eval_cycles)
+{
+  uint32_t k = 0;
+  int32_t counter = 0;
+  bool start_averaging = false;
+  int64_t initial_cycle = 0;
+  uint16_t averaging_over = (eval_cycles > 1)? 1000/eval_cycles : 1000;
+  std::vector<double> indices;
+  std::vector<double> last_magnetization_values;
+  double magnetization[replicas];
+  double energy[replicas];
+  run_interruption interruption;
+  interrupted = false;
+  while(!start_averaging || iter < initial_cycle + cycles)
+  {
+    if(interruption.requested()){
+      interrupted = true;
+      break;
+    }
+    for(uint32_t n = 0; n < eval_cycles; n++) sweep();
+    get_magnetization(magnetization);
+    get_energy(energy);
+    double replica_magnetization = 0;
+    for(uint8_t r = 0; r < replicas; r++) replica_magnetization += std::abs(magnetization[r])/replicas;
+    last_magnetization_values.push_back(replica_magnetization);
+    indices.push_back(iter);
+    if(k > averaging_over)
+    {
+      last_magnetization_values.erase(last_magnetization_values.begin());
+      indices.erase(indices.begin());
+      if(!start_averaging && std::abs(slope(indices,last_magnetization_values)) < 0.000001 && iter > mincycles)
+      {
+        std::cout << "Target slope " << std::abs(slope(indices,last_magnetization_values)) << " reached at " << iter << "." << std::endl;
+        start_averaging = true;
+        initial_cycle = iter;
+      }
+    }
+    if(start_averaging){
+      for(uint8_t r = 0; r < replicas; r++){
+        double m = magnetization[r];
+        double e = energy[r];
+        mean_magnetization[r] = (counter == 0) ? std::abs(m) : (mean_magnetization[r]*counter + std::abs(m))/(counter+1);
+        mean_magnetization_squared[r] = (counter == 0) ? m*m : (mean_magnetization_squared[r]*counter + m*m)/(counter+1);
+        mean_magnetization_fourth[r] = (counter == 0) ? m*m*m*m : (mean_magnetization_fourth[r]*counter + m*m*m*m)/(counter+1);
+        mean_energy[r] = (counter == 0) ? e : (mean_energy[r]*counter + e)/(counter+1);
+        mean_energy_squared[r] = (counter == 0) ? e*e : (mean_energy_squared[r]*counter + e*e)/(counter+1);
+      }
+      counter++;
+    }
+    k++;
+  }
+  samples = counter;
+}
+
+#endif
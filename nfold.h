@@ -0,0 +1,128 @@
+#ifndef NFOLD_H
+#define NFOLD_H
+
+#include <string>
+#include <math.h>
+#include <vector>
+#include "metropolis.h"
+
+// Rejection-free n-fold way (Bortz-Kalos-Lebowitz) for the random-site dynamics of the update rule. The sites are
+// bucketed by their acceptance index, which determines the acceptance probability of a flip.
+// Instead of proposing moves that are rejected, the next accepted flip is chosen directly with the probability of its
+// class, and iter is advanced by the number of proposals the Metropolis algorithm would have needed to reach it. That
+// number is geometrically distributed, the discrete-time counterpart of the exponential waiting time, so that the
+// evolution of iter (and thus datawrite()) is statistically identical to the one of metropolis.
+
+template <uint16_t ARRAY_LEN, typename LAYOUT = row_major<ARRAY_LEN>, typename FIELDS = computed_fields<LAYOUT>, typename RULE = metropolis_rule, typename COUPLINGS = zero_field>
+class nfold: public metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>
+{
+  static_assert(!RULE::overrelaxation, "the n-fold way has no overrelaxation sweeps");
+  public:
+    nfold(float _beta, float bias = 1);                                                                                      // constructor
+    nfold(std::string _filename, float _beta, float bias = 1);                                                               // constructor with filename argument
+    uint32_t flip_next(int64_t max_iter);                                                                                    // flips the next accepted spin unless it would happen after max_iter, returns its site
+    void set_disorder(double antiferro_fraction, double vacancy_fraction);                                                   // draws a new realization of the disorder and reclassifies all sites
+  protected:
+    void advance(uint32_t sweeps) override;                                                                                  // carries out the given number of sweeps, flip by flip
+  private:
+    static constexpr uint8_t classes = COUPLINGS::states;                                                                    // number of classes (acceptance indices)
+    void classify();                                                                                                         // sorts all sites into their classes
+    void reclassify(uint32_t s);                                                                                             // moves the site s into the bucket of its current class
+    std::vector<uint32_t> bucket[classes];                                                                                   // sites of every class, in no particular order
+    std::vector<uint32_t> position;                                                                                          // position of every site within its bucket
+    std::vector<uint8_t> membership;                                                                                         // class of every site
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS>
+nfold<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::nfold(float _beta, float bias) : metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>(_beta,bias)
+{
+  classify();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS>
+nfold<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::nfold(std::string _filename, float _beta, float bias) : metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>(_filename,_beta,bias)
+{
+  classify();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+nfold<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::classify()
+{
+  for(uint8_t c = 0; c < classes; c++) bucket[c].clear();
+  position.resize(LAYOUT::volume);
+  membership.resize(LAYOUT::volume);
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    uint8_t c = this->acceptance_index(s);
+    membership[s] = c;
+    position[s] = bucket[c].size();
+    bucket[c].push_back(s);
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+nfold<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_disorder(double antiferro_fraction, double vacancy_fraction)
+{
+  metropolis<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::set_disorder(antiferro_fraction,vacancy_fraction);
+  classify();
+}
+
+// O(1) removal by moving the last site of the old bucket into the gap, followed by O(1) insertion at the end of the new one.
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+nfold<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::reclassify(uint32_t s)
+{
+  uint8_t c = this->acceptance_index(s);
+  uint8_t old = membership[s];
+  if(c == old) return;
+  uint32_t last = bucket[old].back();
+  bucket[old][position[s]] = last;
+  position[last] = position[s];
+  bucket[old].pop_back();
+  membership[s] = c;
+  position[s] = bucket[c].size();
+  bucket[c].push_back(s);
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> uint32_t
+nfold<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::flip_next(int64_t max_iter)
+{
+  double weight[classes];
+  double total = 0;
+  for(uint8_t c = 0; c < classes; c++){
+    weight[c] = bucket[c].size()*this->acceptance[c];
+    total += weight[c];
+  }
+  // number of Metropolis proposals up to and including the next accepted one
+  double p = total/LAYOUT::volume;
+  double u = 1.-this->real_distribution(this->rng);
+  // compared as a double first, the waiting time of an ordered lattice at low T exceeds the range of int64_t
+  double waiting = (p >= 1.) ? 0 : floor(log(u)/log1p(-p));
+  if(total <= 0 || waiting >= (double) (max_iter - this->iter)){
+    // the geometric distribution is memoryless, hence the pending flip can be discarded at max_iter
+    this->iter = std::max(this->iter,max_iter);
+    return LAYOUT::volume;
+  }
+  this->iter += 1 + (int64_t) waiting;
+  double r = this->real_distribution(this->rng)*total;
+  uint8_t c = 0;
+  while(c < classes-1 && r >= weight[c]){
+    r -= weight[c];
+    c++;
+  }
+  while(bucket[c].empty()) c--;
+  std::uniform_int_distribution<uint32_t> member_distribution(0,bucket[c].size()-1);
+  uint32_t s = bucket[c][member_distribution(this->rng)];
+  this->invert_spin(s);
+  this->flips++;
+  reclassify(s);
+  for(uint8_t k = 0; k < LAYOUT::coordination; k++) reclassify(LAYOUT::neighbour(s,k));
+  return s;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS, typename RULE, typename COUPLINGS> void
+nfold<ARRAY_LEN,LAYOUT,FIELDS,RULE,COUPLINGS>::advance(uint32_t sweeps)
+{
+  int64_t target = this->iter + ((int64_t) sweeps)*LAYOUT::volume;
+  while(this->iter < target) flip_next(target);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <cstdint>
+#include <vector>
+
+// Returns the number of bits per site needed for the given number of states, rounded up to a divisor of 64 so that no
+// site straddles two words.
+constexpr uint8_t
+state_bits(uint16_t states)
+{
+  return (states <= 2) ? 1 : (states <= 4) ? 2 : (states <= 16) ? 4 : 8;
+}
+
+// Lattice of BITS-bit values packed into 64-bit words in the order of the layout, e.g. 32 sites of a 4-state model or
+// 16 sites of a 16-state model per word. A word holds the values of consecutive sites, hence row-major neighbours along
+// the last axis mostly share the word of the site.
+template <uint8_t BITS, uint32_t VOLUME>
+class packed_lattice
+{
+  static_assert(BITS == 1 || BITS == 2 || BITS == 4 || BITS == 8, "the packed lattice requires 1, 2, 4 or 8 bits per site");
+  public:
+    static constexpr uint8_t per_word = 64 / BITS;                                      // number of sites per word
+    static constexpr uint64_t mask = (1ull << BITS) - 1;                                // bits of one site
+    packed_lattice();                                                                   // constructor, all sites are 0
+    uint8_t get(uint32_t s) const;                                                      // returns the value of the site s
+    void set(uint32_t s, uint8_t value);                                                // sets the value of the site s
+  private:
+    std::vector<uint64_t> word;                                                         // packed values of all sites
+};
+
+template <uint8_t BITS, uint32_t VOLUME>
+packed_lattice<BITS,VOLUME>::packed_lattice() : word((VOLUME + per_word - 1) / per_word,0)
+{
+}
+
+template <uint8_t BITS, uint32_t VOLUME> uint8_t
+packed_lattice<BITS,VOLUME>::get(uint32_t s) const
+{
+  return (word[s / per_word] >> ((s % per_word) * BITS)) & mask;
+}
+
+template <uint8_t BITS, uint32_t VOLUME> void
+packed_lattice<BITS,VOLUME>::set(uint32_t s, uint8_t value)
+{
+  uint8_t shift = (s % per_word) * BITS;
+  uint64_t& w = word[s / per_word];
+  w = (w & ~(mask << shift)) | (((uint64_t) value & mask) << shift);
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <fmt/format.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware performance counters of the calling thread (and of the threads it starts meanwhile, where the kernel can
+// inherit grouped counters) through perf_event_open(2), in user space only. The events are opened as two groups that
+// are each scheduled as a whole, so that the ratios within a group are exact: the core group (cycles, instructions,
+// branch misses, L1d misses) and the memory group (L2 misses, LLC misses, dTLB misses). Linux has no generic L2 event;
+// the last-level cache references stand in for the L2 misses, which they are on most Intel and AMD processors. If the
+// PMU has too few counters for both groups, they are multiplexed and the counts are scaled by the time every group was
+// running. Events the processor, the hypervisor or kernel.perf_event_paranoid do not permit are left out (NAN), and
+// without any, the counters are inactive and report why.
+
+enum perf_event_id : uint8_t {perf_cycles, perf_instructions, perf_branch_misses, perf_l1d_misses, perf_l2_misses, perf_llc_misses, perf_dtlb_misses, perf_events};
+
+struct perf_counts
+{
+  double value[perf_events];                                                                     // count of every event, scaled for multiplexing (NAN: not counted)
+  double per(perf_event_id event, uint64_t n) const { return value[event]/n; }                  // returns the count of the event per n (e.g. accepted flips)
+};
+
+class perf_counters
+{
+  public:
+    perf_counters();                                                                             // constructor, opens the groups for the calling thread, stopped
+    ~perf_counters();                                                                            // destructor, closes the groups
+    void start();                                                                                // starts (or resumes) counting
+    void stop();                                                                                 // stops counting
+    perf_counts read();                                                                          // returns the counts accumulated while started
+    bool active;                                                                                 // at least one event is counted
+    std::string error;                                                                           // reason why an event is not counted (empty: all are)
+    static const char* name(uint8_t event);                                                      // returns the name of the event
+  private:
+    struct group
+    {
+      int leader = -1;                                                                           // descriptor of the first event opened (-1: none)
+      std::vector<uint8_t> events;                                                               // events opened, in the order of the values read
+      std::vector<int> descriptors;                                                              // descriptors of the events
+    };
+    void open(group& g, std::initializer_list<uint8_t> events);                                  // opens the events that are permitted as one group
+    group groups[2];                                                                             // core and memory group
+};
+
+inline const char*
+perf_counters::name(uint8_t event)
+{
+  static const char* names[perf_events] = {"cycles","instructions","branch_misses","L1d_misses","L2_misses","LLC_misses","dTLB_misses"};
+  return names[event];
+}
+
+inline
+perf_counters::perf_counters() : active(false)
+{
+  open(groups[0],{perf_cycles,perf_instructions,perf_branch_misses,perf_l1d_misses});
+  open(groups[1],{perf_l2_misses,perf_llc_misses,perf_dtlb_misses});
+  active = groups[0].leader >= 0 || groups[1].leader >= 0;
+}
+
+inline
+perf_counters::~perf_counters()
+{
+  for(group& g : groups) for(int descriptor : g.descriptors) close(descriptor);
+}
+
+inline void
+perf_counters::open(group& g, std::initializer_list<uint8_t> events)
+{
+  auto cache_miss = [](uint64_t cache){ return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); };
+  for(uint8_t event : events){
+    perf_event_attr attributes;
+    memset(&attributes,0,sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    switch(event){
+      case perf_cycles: attributes.config = PERF_COUNT_HW_CPU_CYCLES; break;
+      case perf_instructions: attributes.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+      case perf_branch_misses: attributes.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+      case perf_l2_misses: attributes.config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+      case perf_llc_misses: attributes.config = PERF_COUNT_HW_CACHE_MISSES; break;
+      case perf_l1d_misses: attributes.type = PERF_TYPE_HW_CACHE; attributes.config = cache_miss(PERF_COUNT_HW_CACHE_L1D); break;
+      case perf_dtlb_misses: attributes.type = PERF_TYPE_HW_CACHE; attributes.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB); break;
+    }
+    // the members follow the leader, which starts disabled
+    attributes.disabled = (g.leader < 0);
+    attributes.inherit = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int descriptor = syscall(SYS_perf_event_open,&attributes,0,-1,g.leader,0);
+    // older kernels do not inherit grouped counters, then only the calling thread is counted
+    if(descriptor < 0 && errno == EINVAL){
+      attributes.inherit = 0;
+      descriptor = syscall(SYS_perf_event_open,&attributes,0,-1,g.leader,0);
+    }
+    if(descriptor < 0){
+      if(error.empty()){
+        if(errno == EACCES || errno == EPERM){
+          int paranoid = -1;
+          std::ifstream("/proc/sys/kernel/perf_event_paranoid") >> paranoid;
+          error = fmt::format("not permitted (kernel.perf_event_paranoid = {}, needs <= 2 or CAP_PERFMON)",paranoid);
+        }
+        else if(errno == ENOENT || errno == EOPNOTSUPP || errno == ENODEV) error = fmt::format("{} not supported by this processor or hypervisor",name(event));
+        else error = fmt::format("{}: {}",name(event),strerror(errno));
+      }
+      continue;
+    }
+    if(g.leader < 0) g.leader = descriptor;
+    g.events.push_back(event);
+    g.descriptors.push_back(descriptor);
+  }
+}
+
+inline void
+perf_counters::start()
+{
+  for(group& g : groups) if(g.leader >= 0) ioctl(g.leader,PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+}
+
+inline void
+perf_counters::stop()
+{
+  for(group& g : groups) if(g.leader >= 0) ioctl(g.leader,PERF_EVENT_IOC_DISABLE,PERF_IOC_FLAG_GROUP);
+}
+
+inline perf_counts
+perf_counters::read()
+{
+  perf_counts counts;
+  for(double& value : counts.value) value = NAN;
+  for(group& g : groups){
+    if(g.leader < 0) continue;
+    // number of events, time enabled, time running, one value per event
+    std::vector<uint64_t> data(3 + g.events.size());
+    if(::read(g.leader,data.data(),data.size()*sizeof(uint64_t)) < (ssize_t) (data.size()*sizeof(uint64_t)) || data[0] != g.events.size() || data[2] == 0) continue;
+    for(size_t e = 0; e < g.events.size(); e++) counts.value[g.events[e]] = data[3+e]*((double) data[1]/data[2]);
+  }
+  return counts;
+}
+
+#endif
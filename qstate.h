@@ -0,0 +1,292 @@
+#ifndef QSTATE_H
+#define QSTATE_H
+
+#include <fmt/core.h>
+#include <string>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "layout.h"
+#include "rules.h"
+#include "models.h"
+#include "packed.h"
+#include "sampler.h"
+
+// Monte-Carlo engine for q-state models (see models.h) on any layout, with the states packed into state_bits(q) bits per
+// site. Single-site updates propose one of the q-1 other states uniformly and accept it with the probability of the
+// update rule, tabulated per energy change if the model is quantized; for the Potts model, the energy change is the
+// difference of two entries of the neighbour-state histogram. Alternatively, Wolff cluster updates grow a cluster from
+// a random seed along the bonds that a random reflection of the states would break, and reflect it as a whole. The
+// run loop with the snapshot pipeline, the live view, the metrics, the progress reports and the hardware counters is
+// the one of the Ising engines (see sampler.h); the snapshots hold one state per byte.
+
+template <uint16_t ARRAY_LEN, typename MODEL = potts_model<3>, typename LAYOUT = row_major<ARRAY_LEN>, typename RULE = metropolis_rule>
+class qstate: public sampler<ARRAY_LEN,LAYOUT,uint8_t>
+{
+  static_assert(!RULE::overrelaxation, "overrelaxation is only implemented for the Ising engines");
+  static_assert(!MODEL::diagonal || MODEL::quantum > 0, "the neighbour-state histogram indexes the quantized tables");
+  public:
+    qstate(float _beta, float bias = 1);                                                                                     // constructor, a fraction bias/(1+bias) of the sites starts in state 0, the others at random
+    uint8_t get_state(uint16_t i, uint16_t j);                                                                               // returns the state of the site at position (i,j)
+    uint8_t get_state(uint32_t s);                                                                                           // returns the state of the site s of the layout
+    void set_cluster_updates(bool _cluster);                                                                                 // use Wolff cluster updates instead of single-site updates
+    void wiggle_random_spin();                                                                                               // proposes a random new state at a random site and accepts it according to the rule
+    uint32_t wolff_cluster();                                                                                                // grows and reflects one Wolff cluster, returns its size
+    float energy_change(uint32_t s, uint8_t newstate);                                                                       // returns the energy change upon setting the site s to newstate
+    double get_magnetization();                                                                                              // returns the order parameter of the model
+    double get_energy();                                                                                                     // returns the energy per site
+  protected:
+    void advance(uint32_t sweeps) override;                                                                                  // carries out the given number of sweeps (volume site updates each, on average for clusters)
+    const uint8_t* current_state() override;                                                                                 // returns the states unpacked to one byte per site, e.g. to be copied into a snapshot
+    double order_parameter(const uint8_t* state) override;                                                                   // returns the order parameter of the model for state
+    double energy_per_site(const uint8_t* state) override;                                                                   // returns the energy per site of state
+    uint8_t brightness(uint8_t value) override;                                                                              // returns the gray value of a state in the live view
+    using sampler<ARRAY_LEN,LAYOUT,uint8_t>::beta;                                                                           // beta (-> temperature)
+    using sampler<ARRAY_LEN,LAYOUT,uint8_t>::iter;                                                                           // site updates carried out
+    using sampler<ARRAY_LEN,LAYOUT,uint8_t>::flips;                                                                          // accepted updates and reflected cluster sites, for the metrics
+  private:
+    static constexpr uint8_t states = MODEL::states;                                                                         // number of states per site
+    static constexpr int32_t offset = 2 * LAYOUT::coordination * MODEL::quantum;                                             // index of a vanishing energy change in the tables
+    void tabulate();                                                                                                         // computes the bond energies and the tables for beta
+    double acceptance_probability(float energy_change);                                                                      // returns the probability of the rule for the given energy change
+    double activation_probability(float energy_change);                                                                      // returns the probability of adding a bond with the given energy change to a cluster
+    int32_t histogram_change(uint32_t s, uint8_t newstate);                                                                  // returns the energy change in units of 1/quantum from the neighbour-state histogram (diagonal models)
+    std::mt19937 rng;                                                                                                        // 32-bit Mersenne Twister pseudo-random generator
+    std::uniform_int_distribution<uint32_t> site_distribution;                                                               // converts the 32-bit random numbers to site indices
+    std::uniform_int_distribution<uint16_t> state_distribution;                                                              // converts the 32-bit random numbers to one of the q-1 other states
+    std::uniform_int_distribution<uint16_t> reflection_distribution;                                                         // converts the 32-bit random numbers to reflections
+    std::uniform_real_distribution<double> real_distribution;                                                                // converts the 32-bit random numbers to real interval
+    packed_lattice<state_bits(MODEL::states),LAYOUT::volume> spin;                                                           // state of the system, ordered by the layout
+    std::vector<uint8_t> unpacked;                                                                                           // state of the system, one byte per site, as returned by current_state()
+    float bond[states][states];                                                                                              // bond energies of all pairs of states
+    std::vector<double> acceptance;                                                                                          // acceptance per quantized energy change
+    std::vector<double> activation;                                                                                          // bond activation per quantized energy change
+    bool cluster;                                                                                                            // Wolff cluster updates instead of single-site updates
+    std::vector<uint32_t> stack;                                                                                             // sites of the cluster whose neighbours have not been tested yet
+    std::vector<uint32_t> visited;                                                                                           // number of the last cluster that contained the site
+    uint32_t clusters;                                                                                                       // number of clusters grown, modulo 2^32
+    uint64_t cluster_count;                                                                                                  // number of clusters grown
+    uint64_t cluster_sites;                                                                                                  // total size of the clusters grown
+};
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE>
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::qstate(float _beta, float bias) : sampler<ARRAY_LEN,LAYOUT,uint8_t>(_beta,bias,true) , rng(std::random_device{}()) , site_distribution{0,LAYOUT::volume-1} , state_distribution{0,states-2} , reflection_distribution{0,MODEL::reflections-1} , real_distribution{0.0,1.0} , unpacked(LAYOUT::volume)
+{
+  cluster = false;
+  clusters = 0;
+  cluster_count = 0;
+  cluster_sites = 0;
+  visited.assign(LAYOUT::volume,0);
+  std::uniform_real_distribution<float> biased_distribution(0.0,1.+1./bias);
+  std::uniform_int_distribution<uint16_t> any_state(0,states-1);
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    spin.set(s,(biased_distribution(rng) < 1.) ? 0 : any_state(rng));
+  }
+  tabulate();
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> void
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::tabulate()
+{
+  for(uint8_t a = 0; a < states; a++){
+    for(uint8_t b = 0; b < states; b++) bond[a][b] = MODEL::bond_energy(a,b);
+  }
+  if constexpr (MODEL::quantum > 0){
+    acceptance.resize(2*offset+1);
+    activation.resize(2*offset+1);
+    for(int32_t index = 0; index <= 2*offset; index++){
+      float energy_change = ((float) (index - offset))/MODEL::quantum;
+      acceptance[index] = RULE::probability(beta,energy_change);
+      activation[index] = 1.-metropolis_rule::probability(beta,energy_change);
+    }
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> double
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::acceptance_probability(float energy_change)
+{
+  if constexpr (MODEL::quantum > 0){
+    return acceptance[lround(energy_change*MODEL::quantum) + offset];
+  }
+  else{
+    return RULE::probability(beta,energy_change);
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> double
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::activation_probability(float energy_change)
+{
+  if constexpr (MODEL::quantum > 0){
+    return activation[lround(energy_change*MODEL::quantum) + offset];
+  }
+  else{
+    return 1.-metropolis_rule::probability(beta,energy_change);
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> uint8_t
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::get_state(uint16_t i, uint16_t j)
+{
+  return spin.get(LAYOUT::site(i,j));
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> uint8_t
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::get_state(uint32_t s)
+{
+  return spin.get(s);
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> void
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::set_cluster_updates(bool _cluster)
+{
+  cluster = _cluster;
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> float
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::energy_change(uint32_t s, uint8_t newstate)
+{
+  if constexpr (MODEL::diagonal){
+    return ((float) histogram_change(s,newstate))/MODEL::quantum;
+  }
+  uint8_t oldstate = spin.get(s);
+  float sum = 0;
+  for(uint8_t k = 0; k < LAYOUT::coordination; k++){
+    uint8_t neighbour = spin.get(LAYOUT::neighbour(s,k));
+    sum += bond[newstate][neighbour] - bond[oldstate][neighbour];
+  }
+  return sum;
+}
+
+// With bond energies -delta(a,b)/quantum, the energy change is the number of neighbours in the old state minus the
+// number in the new one, which indexes the acceptance table directly.
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> int32_t
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::histogram_change(uint32_t s, uint8_t newstate)
+{
+  uint8_t histogram[states] = {};
+  for(uint8_t k = 0; k < LAYOUT::coordination; k++) histogram[spin.get(LAYOUT::neighbour(s,k))]++;
+  return ((int32_t) histogram[spin.get(s)] - histogram[newstate]) * MODEL::quantum;
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> void
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::wiggle_random_spin()
+{
+  uint32_t s = site_distribution(rng);
+  uint8_t newstate = (spin.get(s) + 1 + state_distribution(rng)) % states;
+  double probability;
+  if constexpr (MODEL::diagonal){
+    probability = acceptance[histogram_change(s,newstate) + offset];
+  }
+  else{
+    probability = acceptance_probability(energy_change(s,newstate));
+  }
+  if(probability >= 1. || real_distribution(rng) < probability){
+    spin.set(s,newstate);
+    flips++;
+  }
+  iter++;
+}
+
+// The states of the cluster are reflected as soon as a site joins, and every site is tested at most once per neighbour in
+// the cluster. Since the reflection is an involution, the state of a cluster site before the reflection is recovered
+// by reflecting it again.
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> uint32_t
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::wolff_cluster()
+{
+  if(++clusters == 0){
+    visited.assign(LAYOUT::volume,0);
+    clusters = 1;
+  }
+  uint32_t seed = site_distribution(rng);
+  uint8_t seed_state = spin.get(seed);
+  uint8_t r = reflection_distribution(rng);
+  uint32_t size = 1;
+  visited[seed] = clusters;
+  spin.set(seed,MODEL::reflect(seed_state,seed_state,r));
+  stack.push_back(seed);
+  while(!stack.empty()){
+    uint32_t s = stack.back();
+    stack.pop_back();
+    uint8_t oldstate = MODEL::reflect(spin.get(s),seed_state,r);
+    uint8_t newstate = spin.get(s);
+    for(uint8_t k = 0; k < LAYOUT::coordination; k++){
+      uint32_t n = LAYOUT::neighbour(s,k);
+      if(visited[n] == clusters) continue;
+      uint8_t neighbour = spin.get(n);
+      double probability = activation_probability(bond[newstate][neighbour] - bond[oldstate][neighbour]);
+      if(probability > 0. && real_distribution(rng) < probability){
+        visited[n] = clusters;
+        spin.set(n,MODEL::reflect(neighbour,seed_state,r));
+        stack.push_back(n);
+        size++;
+      }
+    }
+  }
+  cluster_count++;
+  cluster_sites += size;
+  flips += size;
+  return size;
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> void
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::advance(uint32_t sweeps)
+{
+  int64_t target = iter + ((int64_t) sweeps)*LAYOUT::volume;
+  if(cluster && cluster_sites == 0){
+    while(iter < target) iter += wolff_cluster();
+  }
+  else if(cluster){
+    // stopping as soon as target is reached would favour the states right after large clusters
+    uint64_t count = std::max<uint64_t>(llround(((double) sweeps)*LAYOUT::volume*cluster_count/cluster_sites),1);
+    for(uint64_t n = 0; n < count; n++) iter += wolff_cluster();
+  }
+  else{
+    while(iter < target) wiggle_random_spin();
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> double
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::get_magnetization()
+{
+  return order_parameter(current_state());
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> double
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::get_energy()
+{
+  return energy_per_site(current_state());
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> const uint8_t*
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::current_state()
+{
+  for(uint32_t s = 0; s < LAYOUT::volume; s++) unpacked[s] = spin.get(s);
+  return unpacked.data();
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> double
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::order_parameter(const uint8_t* state)
+{
+  uint32_t counts[states] = {0};
+  for(uint32_t s = 0; s < LAYOUT::volume; s++) counts[state[s]]++;
+  return MODEL::order_parameter(counts,LAYOUT::volume);
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> double
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::energy_per_site(const uint8_t* state)
+{
+  double sum = 0;
+  for(uint32_t s = 0; s < LAYOUT::volume; s++){
+    for(uint8_t k = 1; k < LAYOUT::coordination; k += 2) sum += bond[state[s]][state[LAYOUT::neighbour(s,k)]];
+  }
+  return sum/LAYOUT::volume;
+}
+
+template <uint16_t ARRAY_LEN, typename MODEL, typename LAYOUT, typename RULE> uint8_t
+qstate<ARRAY_LEN,MODEL,LAYOUT,RULE>::brightness(uint8_t value)
+{
+  return value*255/(states-1);
+}
+
+#endif
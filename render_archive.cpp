@@ -0,0 +1,86 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fmt/core.h>
+#include <opencv2/opencv.hpp>
+
+#include "archive.h"
+
+// Renders frames of a snapshot archive (main built with ARCHIVE, see archive.h) offline: the first plane of every
+// selected state in gray, box-filtered down to at most the given resolution, into a video (output ending in .mkv, .avi
+// or .mp4) or into one PNG image per frame (output_<frame>.png). Without output, the frames of the archive are listed.
+
+// draws the first plane of the packed state into frame, averaging boxes of box x box sites into one pixel
+void render(const std::vector<uint64_t>& words, uint16_t length, uint16_t box, cv::Mat& frame)
+{
+  uint16_t pixels = length/box;
+  frame.create(pixels,pixels,CV_8UC3);
+  std::vector<uint32_t> sums(pixels);
+  for(uint16_t r = 0; r < pixels; r++){
+    std::fill(sums.begin(),sums.end(),0);
+    for(uint32_t i = (uint32_t) r*box; i < (uint32_t) (r+1)*box; i++){
+      for(uint16_t c = 0; c < pixels; c++){
+        for(uint32_t j = (uint32_t) c*box; j < (uint32_t) (c+1)*box; j++) sums[c] += snapshot_archive_reader::bit(words,i*length+j);
+      }
+    }
+    cv::Vec3b* pixel = frame.ptr<cv::Vec3b>(r);
+    for(uint16_t c = 0; c < pixels; c++){
+      uint8_t gray = sums[c]*255/((uint32_t) box*box);
+      pixel[c] = cv::Vec3b(gray,gray,gray);
+    }
+  }
+}
+
+bool is_video(const std::string& output)
+{
+  for(std::string extension : {".mkv",".avi",".mp4"}){
+    if(output.size() > extension.size() && output.compare(output.size()-extension.size(),extension.size(),extension) == 0) return true;
+  }
+  return false;
+}
+
+int main(int argc, char *argv[]){
+  if(argc != 2 && argc < 5){
+    std::cout << "Usage:\n\tOption 1: " << argv[0] << " archive\n\tOption 2: " << argv[0] << " archive output first_frame last_frame [step [resolution]]" << std::endl;
+    return 0;
+  }
+  snapshot_archive_reader archive(argv[1]);
+  if(!archive.valid){
+    std::cout << "Cannot read the archive " << argv[1] << "." << std::endl;
+    return 1;
+  }
+  if(argc == 2){
+    std::cout << fmt::format("L = {}, d = {}, {} frames",archive.length,archive.dimension,archive.index.size());
+    if(!archive.index.empty()) std::cout << fmt::format(" from {:.0f} to {:.0f} sweeps",archive.index.front().sweeps,archive.index.back().sweeps);
+    std::cout << "." << std::endl;
+    for(size_t n = 0; n < archive.index.size(); n++) std::cout << fmt::format("{}\t{:.2f}\t{}",n,archive.index[n].sweeps,archive.index[n].keyframe ? "key" : "delta") << std::endl;
+    return 0;
+  }
+  std::string output = argv[2];
+  size_t first = atoi(argv[3]);
+  size_t last = std::min<size_t>(atoi(argv[4]),archive.index.size()-1);
+  size_t step = (argc > 5) ? std::max(atoi(argv[5]),1) : 1;
+  uint16_t resolution = (argc > 6) ? atoi(argv[6]) : archive.length;
+  uint16_t box = (resolution == 0) ? 1 : std::max((archive.length+resolution-1)/resolution,1);
+  std::vector<uint64_t> words;
+  cv::Mat frame;
+  cv::VideoWriter video;
+  uint32_t rendered = 0;
+  for(size_t n = first; n <= last && n < archive.index.size(); n += step){
+    if(!archive.read(n,words)){
+      std::cout << "Frame " << n << " is damaged." << std::endl;
+      break;
+    }
+    render(words,archive.length,box,frame);
+    if(is_video(output)){
+      if(!video.isOpened()) video.open(output,cv::VideoWriter::fourcc('X','2','6','4'),30,cv::Size(frame.cols,frame.rows));
+      video.write(frame);
+    }
+    else cv::imwrite(fmt::format("{}_{:06d}.png",output,n),frame);
+    rendered++;
+  }
+  video.release();
+  std::cout << "Rendered " << rendered << " frames." << std::endl;
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <cstdint>
+#include <math.h>
+
+// An update rule provides the probability with which a proposed flip with the given energy change is accepted. The
+// engines tabulate it once per beta for every local state of a site. If overrelaxation is set, every sweep is followed by
+// an overrelaxation sweep that flips all spins with vanishing energy change; these flips conserve the energy and are
+// their own inverse, so they leave the Boltzmann distribution invariant while moving the configuration along the
+// energy shell.
+
+struct metropolis_rule
+{
+  static constexpr bool overrelaxation = false;                                 // no overrelaxation sweeps
+  static double probability(float beta, float energy_change);                  // returns min(1,exp(-beta*energy_change))
+};
+
+inline double
+metropolis_rule::probability(float beta, float energy_change)
+{
+  return (energy_change <= 0) ? 1. : exp(-beta*energy_change);
+}
+
+// Heat-bath (Glauber) rule: the spin is set according to its local Boltzmann weights, which is equivalent to accepting
+// the flip with probability 1/(1+exp(beta*energy_change)).
+struct heat_bath_rule
+{
+  static constexpr bool overrelaxation = false;                                 // no overrelaxation sweeps
+  static double probability(float beta, float energy_change);                  // returns 1/(1+exp(beta*energy_change))
+};
+
+inline double
+heat_bath_rule::probability(float beta, float energy_change)
+{
+  return 1./(1.+exp(beta*energy_change));
+}
+
+struct overrelaxed_metropolis_rule
+{
+  static constexpr bool overrelaxation = true;                                  // every sweep is followed by an overrelaxation sweep
+  static double probability(float beta, float energy_change);                  // returns min(1,exp(-beta*energy_change))
+};
+
+inline double
+overrelaxed_metropolis_rule::probability(float beta, float energy_change)
+{
+  return metropolis_rule::probability(beta,energy_change);
+}
+
+#endif
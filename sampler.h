@@ -0,0 +1,307 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <fmt/core.h>
+#include <string>
+#include <iostream>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include "avg_stdev.h"
+#include "snapshots.h"
+#include "live_view.h"
+#include "shutdown.h"
+#include "metrics.h"
+#include "perf_counters.h"
+
+// data published with every snapshot of run()
+struct sweep_info
+{
+  uint32_t cycle;                                                                                                            // sweeps carried out by run() (0: initial state)
+  int64_t iter;                                                                                                              // iterations carried out by the engine
+  double fourier_squared;                                                                                                    // |m(k)|^2, tracked by the engine
+};
+
+// The run loop shared by the engines whose state is an array of SITE values in the order of the layout: the sweeps,
+// the snapshot pipeline with the observables stage and the live view, the metrics, the progress reports, the hardware
+// counters and equilibrate(). An engine supplies its sweeps, its current state and the observables of a state, and may
+// attach further stages to the pipeline of every run.
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE>
+class sampler
+{
+  public:
+    typedef snapshot<SITE,sweep_info> frame;                                                                                 // snapshot of the state taken by run()
+    sampler(float _beta, float _bias, bool _reporting);                                                                      // constructor, _reporting prints the equilibration and the load of the stages of every run
+    virtual ~sampler() = default;                                                                                            // destructor
+    double run(uint32_t mincycles = 4000, uint32_t cycles = 10000, uint32_t eval_cycles = 1, uint32_t frame_cycles = 1);     // runs the Monte-Carlo simulation, may be called repeatedly
+    uint32_t equilibrate(uint32_t maxcycles = 100000);                                                                       // sweeps until the configuration is equilibrated (at most maxcycles), returns the number of sweeps
+    void set_snapshot_buffers(uint8_t _snapshot_buffers);                                                                    // number of snapshots in flight between the sweeps and the measurements of run() (0: measure synchronously)
+    void set_progress(double _progress_interval);                                                                            // reports the sweep rate and the remaining time of run() every _progress_interval seconds (0: never)
+    void set_live_view(live_view* _view);                                                                                    // publishes a frame to _view every frame_cycles cycles of run() and ends the run when a viewer asks (nullptr: none)
+    void set_perf_counters(bool _profiling);                                                                                 // counts the hardware events of the sweeps of run() (see perf_counters.h)
+    double mean_magnetization;                                                                                               // average abolute value of the magnetization (order parameter) per spin
+    double mean_magnetization_squared;                                                                                       // average square of the magnetization per spin
+    double mean_magnetization_fourth;                                                                                        // average fourth power of the magnetization per spin
+    double mean_energy;                                                                                                      // average energy per spin
+    double mean_energy_squared;                                                                                              // the square of the energy per spin
+    double mean_fourier_squared;                                                                                             // average |m(k)|^2 at the smallest nonzero wave vectors (NAN unless tracked)
+    double correlation_length;                                                                                               // second-moment correlation length from mean_magnetization_squared and mean_fourier_squared
+    bool interrupted;                                                                                                        // the last run() was stopped early by a signal or a viewer (see shutdown.h)
+    uint32_t samples;                                                                                                        // number of snapshots averaged by the last run()
+    perf_counts counters;                                                                                                    // hardware events of the sweeps of the last run() (all NAN unless profiling)
+    uint64_t run_flips;                                                                                                      // accepted flips of the last run()
+    int64_t run_proposals;                                                                                                   // proposed flips of the last run()
+  protected:
+    virtual void advance(uint32_t sweeps) = 0;                                                                               // carries out the given number of sweeps with the selected update scheme
+    virtual const SITE* current_state() = 0;                                                                                 // returns the state of all sites in the order of the layout, e.g. to be copied into a snapshot
+    virtual double order_parameter(const SITE* state) = 0;                                                                   // returns the magnetization (order parameter) per site of state
+    virtual double energy_per_site(const SITE* state) = 0;                                                                   // returns the energy per site of state
+    virtual uint8_t brightness(SITE value) = 0;                                                                              // returns the gray value of a site in the live view
+    virtual double fourier_squared();                                                                                        // returns |m(k)|^2 of the current state if the engine tracks it (NAN otherwise)
+    virtual uint32_t batch(uint32_t sweeps);                                                                                 // returns the sweeps to advance at once instead of the given ones
+    virtual void begin_run(bool counting);                                                                                   // prepares the engine for a run, counting: the hardware counters are running
+    virtual void attach_stages(snapshot_pipeline<SITE,sweep_info>& pipeline, std::function<bool(const frame&)> averaging, uint32_t frame_cycles); // attaches the stages of the engine, averaging tells whether a snapshot is averaged
+    virtual void end_run(uint32_t cycle);                                                                                    // completes the output of a run that ended after cycle sweeps, the stages are drained
+    float beta;                                                                                                              // beta (-> temperature)
+    int64_t iter;                                                                                                            // iterations carried out
+    uint64_t flips;                                                                                                          // accepted flips (without overrelaxation), for the metrics
+    float bias;                                                                                                              // bias of the initial state (label of the metrics)
+    bool reporting;                                                                                                          // the equilibration and the load of the stages are printed
+  private:
+    uint8_t snapshot_buffers;                                                                                                // snapshots in flight between the sweeps and the measurements (0: synchronous)
+    live_view* view;                                                                                                         // shared-memory segment watched by viewers (not owned, nullptr: none)
+    double progress_interval;                                                                                                // seconds between the progress reports of run() (0: never)
+    bool profiling;                                                                                                          // the sweeps of run() are wrapped in hardware performance counters
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE>
+sampler<ARRAY_LEN,LAYOUT,SITE>::sampler(float _beta, float _bias, bool _reporting)
+{
+  beta = _beta;
+  iter = 0;
+  flips = 0;
+  bias = _bias;
+  reporting = _reporting;
+  snapshot_buffers = 2;
+  view = nullptr;
+  progress_interval = 0;
+  profiling = false;
+  mean_fourier_squared = NAN;
+  correlation_length = NAN;
+  interrupted = false;
+  samples = 0;
+  run_flips = 0;
+  run_proposals = 0;
+  for(double& value : counters.value) value = NAN;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> void
+sampler<ARRAY_LEN,LAYOUT,SITE>::set_snapshot_buffers(uint8_t _snapshot_buffers){
+  snapshot_buffers = _snapshot_buffers;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> void
+sampler<ARRAY_LEN,LAYOUT,SITE>::set_progress(double _progress_interval){
+  progress_interval = _progress_interval;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> void
+sampler<ARRAY_LEN,LAYOUT,SITE>::set_live_view(live_view* _view){
+  view = _view;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> void
+sampler<ARRAY_LEN,LAYOUT,SITE>::set_perf_counters(bool _profiling){
+  profiling = _profiling;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> double
+sampler<ARRAY_LEN,LAYOUT,SITE>::fourier_squared(){
+  return NAN;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> uint32_t
+sampler<ARRAY_LEN,LAYOUT,SITE>::batch(uint32_t sweeps){
+  return sweeps;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> void
+sampler<ARRAY_LEN,LAYOUT,SITE>::begin_run(bool){
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> void
+sampler<ARRAY_LEN,LAYOUT,SITE>::attach_stages(snapshot_pipeline<SITE,sweep_info>&, std::function<bool(const frame&)>, uint32_t){
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> void
+sampler<ARRAY_LEN,LAYOUT,SITE>::end_run(uint32_t){
+}
+
+// The sweeps publish a snapshot of the lattice after every eval_cycles sweeps (at least batch(eval_cycles)) and carry
+// on; the averages and the detection of equilibration (the slope of m over the last 1000 sweeps), the stages of the
+// engine (see attach_stages()) and the live view (every frame_cycles cycles) are taken from the snapshots by the
+// stages of the pipeline (see snapshots.h). Snapshots dropped because all buffers are in use only reduce the number of
+// samples. The sweeps stop once the observables stage has seen cycles sweeps after equilibration, or early when a viewer
+// or a signal asks for it (see shutdown.h), keeping the averages so far. While a metrics exporter runs, the sweeps,
+// flips, m, e and equilibration status are published to a slot (see metrics.h). When profiling, only the sweeps are
+// counted by the hardware counters, not the publication of the snapshots.
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> double
+sampler<ARRAY_LEN,LAYOUT,SITE>::run(uint32_t mincycles, uint32_t cycles, uint32_t eval_cycles, uint32_t frame_cycles){
+  uint32_t k = 0;
+  uint32_t cycle = 0;
+  int32_t counter = 0;
+  int64_t initial_iter = iter;
+  // mincycles = 0: the configuration is already equilibrated (see equilibrate()), averaging starts at once
+  std::atomic<bool> start_averaging(mincycles == 0);
+  std::atomic<uint32_t> initial_cycle(0);
+  eval_cycles = batch(eval_cycles);
+  uint16_t averaging_over = (eval_cycles > 1)? 1000/eval_cycles : 1000;
+  std::vector<double> indices;
+  std::vector<double> last_magnetization_values;
+  uint32_t last_viewed = 0;
+  std::chrono::steady_clock::time_point last_progress = std::chrono::steady_clock::now();
+  uint32_t last_progress_cycle = 0;
+  run_interruption interruption;
+  metrics_run metrics(ARRAY_LEN,1/beta,bias);
+  uint64_t initial_flips = flips;
+  uint64_t last_rate_flips = flips;
+  uint64_t last_rate_time = metrics_clock();
+  std::unique_ptr<perf_counters> hardware(profiling ? new perf_counters() : nullptr);
+  begin_run(hardware != nullptr);
+  std::function<bool(const frame&)> averaging = [&](const frame& f){ return f.info.cycle > 0 && start_averaging && f.info.cycle >= initial_cycle; };
+  snapshot_pipeline<SITE,sweep_info> pipeline(LAYOUT::volume,snapshot_buffers);
+  pipeline.attach("observables",[&](const frame& f){
+    if(f.info.cycle == 0) return;
+    double magnetization = order_parameter(f.sites);
+    double energy = energy_per_site(f.sites);
+    if(metrics.slot != nullptr){
+      metrics.slot->magnetization.store(magnetization,std::memory_order_relaxed);
+      metrics.slot->energy.store(energy,std::memory_order_relaxed);
+    }
+    last_magnetization_values.push_back(magnetization);
+    indices.push_back(((double) f.info.iter)/LAYOUT::volume);
+    if(k > averaging_over)
+    {
+      last_magnetization_values.erase(last_magnetization_values.begin());
+      indices.erase(indices.begin());
+      if(!start_averaging && std::abs(slope(indices,last_magnetization_values)) < 0.000001 && f.info.cycle > mincycles)
+      {
+        if(reporting) std::cout << "Target slope " << std::abs(slope(indices,last_magnetization_values)) << " reached at " << f.info.cycle << "." << std::endl;
+        initial_cycle = f.info.cycle;
+        start_averaging = true;
+      }
+    }
+    if(start_averaging){
+      mean_magnetization = (counter == 0) ? std::abs(magnetization) : (mean_magnetization*counter + std::abs(magnetization))/(counter+1);
+      mean_magnetization_squared = (counter == 0) ? magnetization*magnetization : (mean_magnetization_squared*counter + magnetization*magnetization)/(counter+1);
+      mean_magnetization_fourth = (counter == 0) ? magnetization*magnetization*magnetization*magnetization : (mean_magnetization_fourth*counter + magnetization*magnetization*magnetization*magnetization)/(counter+1);
+      mean_energy = (counter == 0) ? energy : (mean_energy*counter + energy)/(counter+1);
+      mean_energy_squared = (counter == 0) ? energy*energy : (mean_energy_squared*counter + energy*energy)/(counter+1);
+      mean_fourier_squared = (counter == 0) ? f.info.fourier_squared : (mean_fourier_squared*counter + f.info.fourier_squared)/(counter+1);
+      counter++;
+    }
+    k++;
+  });
+  attach_stages(pipeline,averaging,frame_cycles);
+  if(view != nullptr) pipeline.attach("view",[&](const frame& f){
+    if(f.info.cycle > 0 && f.info.cycle < last_viewed + frame_cycles) return;
+    view->publish(ARRAY_LEN,[&](uint16_t i, uint16_t j){ return brightness(f.sites[LAYOUT::site(i,j)]); },f.info.cycle,order_parameter(f.sites),energy_per_site(f.sites),1/beta);
+    last_viewed = f.info.cycle;
+  });
+  pipeline.publish(current_state(),{0,iter,fourier_squared()});
+  interrupted = false;
+  while(!(start_averaging && cycle >= initial_cycle + cycles))
+  {
+    if(interruption.requested() || (view != nullptr && view->stop_requested())){
+      interrupted = true;
+      break;
+    }
+    uint64_t sweep_begin = (metrics.slot != nullptr) ? metrics_clock() : 0;
+    if(hardware) hardware->start();
+    advance(eval_cycles);
+    if(hardware) hardware->stop();
+    cycle = (iter - initial_iter)/LAYOUT::volume;
+    pipeline.publish(current_state(),{cycle,iter,fourier_squared()});
+    if(metrics.slot != nullptr){
+      uint64_t now = metrics_clock();
+      metrics.slot->sweeps.store(cycle,std::memory_order_relaxed);
+      metrics.slot->proposals.store(iter - initial_iter,std::memory_order_relaxed);
+      metrics.slot->flips.store(flips - initial_flips,std::memory_order_relaxed);
+      metrics.slot->equilibrated.store(start_averaging,std::memory_order_relaxed);
+      metrics.slot->sweeping.store(metrics.slot->sweeping.load(std::memory_order_relaxed) + now - sweep_begin,std::memory_order_relaxed);
+      metrics.slot->updated.store(now,std::memory_order_relaxed);
+      if(now - last_rate_time >= 1000000000){
+        metrics.slot->flip_rate.store((flips - last_rate_flips)*1e9/(now - last_rate_time),std::memory_order_relaxed);
+        last_rate_flips = flips;
+        last_rate_time = now;
+      }
+    }
+    if(progress_interval > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - last_progress).count() >= progress_interval){
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      double rate = (cycle - last_progress_cycle)/std::chrono::duration<double>(now - last_progress).count();
+      // before equilibration, the run takes at least mincycles and then cycles more sweeps
+      double left = start_averaging ? initial_cycle + cycles - std::min<uint32_t>(cycle,initial_cycle + cycles) : std::max(mincycles,cycle) - cycle + cycles;
+      std::string eta = (rate > 0) ? fmt::format("{}{:.0f} s",start_averaging ? "" : ">= ",left/rate) : "unknown";
+      // one write per line, so that the reports of concurrent runs do not interleave
+      std::cout << fmt::format("Progress: {} sweeps, {:.1f} sweeps/s, {}, ETA {}.\n",cycle,rate,start_averaging ? "averaging" : "equilibrating",eta) << std::flush;
+      last_progress = now;
+      last_progress_cycle = cycle;
+    }
+  }
+  pipeline.drain();
+  samples = counter;
+  run_flips = flips - initial_flips;
+  run_proposals = iter - initial_iter;
+  if(hardware) counters = hardware->read();
+  end_run(cycle);
+  if(reporting){
+    pipeline.report(std::cout);
+    if(hardware && hardware->active){
+      std::cout << fmt::format("Counters per flip ({} flips, acceptance {:.3f}): {:.1f} cycles, {:.1f} instructions (IPC {:.2f})",run_flips,(double) run_flips/std::max<int64_t>(run_proposals,1),counters.per(perf_cycles,run_flips),counters.per(perf_instructions,run_flips),counters.value[perf_instructions]/counters.value[perf_cycles]);
+      for(uint8_t event = perf_branch_misses; event < perf_events; event++) std::cout << fmt::format(", {:.3f} {}",counters.per((perf_event_id) event,run_flips),perf_counters::name(event));
+      std::cout << "." << std::endl;
+    }
+    if(hardware && !hardware->error.empty()) std::cout << "Counters: " << (hardware->active ? "partly unavailable, " : "unavailable, ") << hardware->error << "." << std::endl;
+  }
+  // xi = sqrt(chi(0)/chi(k) - 1) / (2 sin(k/2)) with k = 2 pi / ARRAY_LEN
+  correlation_length = sqrt(std::max(mean_magnetization_squared/mean_fourier_squared - 1,0.))/(2*sin(M_PI/ARRAY_LEN));
+  return mean_magnetization;
+}
+
+// Compares the averages of |m| and e over two consecutive blocks of sweeps, doubling the length of the block until both
+// agree within twice their (autocorrelation-free, hence too small) statistical errors.
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename SITE> uint32_t
+sampler<ARRAY_LEN,LAYOUT,SITE>::equilibrate(uint32_t maxcycles){
+  uint32_t step = batch(1);
+  auto measure = [&](uint32_t block, running_stdev& magnetization, running_stdev& energy){
+    for(uint32_t n = 0; n < block && !shutdown_requested(); n += step){
+      advance(step);
+      const SITE* state = current_state();
+      magnetization.push(std::abs(order_parameter(state)));
+      energy.push(energy_per_site(state));
+    }
+  };
+  auto agree = [](const running_stdev& a, const running_stdev& b){
+    return std::abs(a.mean - b.mean) <= 2*sqrt(a.error()*a.error() + b.error()*b.error());
+  };
+  uint32_t block = 16;
+  uint32_t cycles = block;
+  running_stdev previous_magnetization, previous_energy;
+  measure(block,previous_magnetization,previous_energy);
+  while(cycles < maxcycles && !shutdown_requested()){
+    running_stdev magnetization, energy;
+    measure(block,magnetization,energy);
+    cycles += block;
+    if(agree(previous_magnetization,magnetization) && agree(previous_energy,energy)) break;
+    previous_magnetization = magnetization;
+    previous_energy = energy;
+    block *= 2;
+  }
+  return cycles;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SHUTDOWN_H
+#define SHUTDOWN_H
+
+#include <csignal>
+#include <signal.h>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+
+// Graceful shutdown on signals: SIGINT and SIGTERM (e.g. sent by a job scheduler before pre-emption) ask every run to
+// stop after its current sweep and no further runs to start, so that the averages so far are reported, the video and
+// the archive are finalized and the journal holds all completed runs; a second SIGINT or SIGTERM terminates at once.
+// SIGUSR1 only ends the runs in progress early (like ESC in the viewer), and the next ones start as usual. The handler
+// only touches lock-free atomics, which the sweeps poll.
+
+inline std::atomic<int> shutdown_signal(0);                                                      // signal that asked to shut down (0: none)
+inline std::atomic<uint32_t> skip_generation(0);                                                 // number of SIGUSR1 received
+
+static_assert(std::atomic<int>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "the signal handler requires lock-free atomics");
+
+extern "C" inline void
+on_shutdown_signal(int signal)
+{
+  if(signal == SIGUSR1){
+    skip_generation++;
+    return;
+  }
+  if(shutdown_signal.exchange(signal) != 0){
+    std::signal(signal,SIG_DFL);
+    std::raise(signal);
+  }
+}
+
+// installs the handler for SIGINT, SIGTERM and SIGUSR1 and ignores SIGPIPE
+inline void
+install_shutdown_handlers()
+{
+  struct sigaction action = {};
+  action.sa_handler = on_shutdown_signal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  for(int signal : {SIGINT,SIGTERM,SIGUSR1}) sigaction(signal,&action,nullptr);
+  // an external video encoder (see set_video_pipe()) receives SIGINT from the terminal as well, its closed pipe must not end the simulation
+  std::signal(SIGPIPE,SIG_IGN);
+}
+
+// returns whether SIGINT or SIGTERM asked to shut down
+inline bool
+shutdown_requested()
+{
+  return shutdown_signal.load(std::memory_order_relaxed) != 0;
+}
+
+// Tells a run whether it is to stop early: on shutdown, or on SIGUSR1 received since the run started.
+class run_interruption
+{
+  public:
+    run_interruption() : generation(skip_generation.load()) {}                                   // constructor, at the start of the run
+    bool requested() const { return shutdown_requested() || skip_generation.load(std::memory_order_relaxed) != generation; } // returns whether the run is to stop
+  private:
+    uint32_t generation;                                                                         // SIGUSR1 received before the run started
+};
+
+#endif
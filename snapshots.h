@@ -0,0 +1,184 @@
+#ifndef SNAPSHOTS_H
+#define SNAPSHOTS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <fmt/format.h>
+#include "metrics.h"
+
+// Decouples the measurements from the sweeps: publish() copies the state of the lattice into a free preallocated buffer
+// and returns at once, and every attached stage (observables, correlations, clusters, output, ...) consumes the
+// published snapshots in order on a worker thread of its own. A buffer is reused once all stages are done with it; if
+// no buffer is free, the snapshot is dropped rather than delaying the sweeps (back-pressure), and the drops as well as
+// the busy time and the largest backlog of every stage are accounted for in report(). With no buffers at all, the
+// stages run synchronously in publish() on the live state (e.g. when all cores are busy sweeping anyway). The workers
+// export their busy time as threads named after their stage (see metrics.h).
+
+template <typename SITE, typename INFO>
+struct snapshot
+{
+  const SITE* sites;                                                                                                         // state of every site in the order of the layout
+  INFO info;                                                                                                                 // data taken along with the state (sweep, tracked observables, ...)
+};
+
+template <typename SITE, typename INFO>
+class snapshot_pipeline
+{
+  public:
+    snapshot_pipeline(uint32_t _volume, uint8_t _buffers = 2);                                                               // constructor for snapshots of _volume sites
+    ~snapshot_pipeline();                                                                                                    // destructor, consumes the pending snapshots and stops the workers
+    void attach(std::string name, std::function<void(const snapshot<SITE,INFO>&)> consume);                                  // adds a stage with its own worker (before the first snapshot is published)
+    bool publish(const SITE* state, const INFO& info);                                                                       // copies the state into a free buffer for all stages, returns false if it was dropped
+    void drain();                                                                                                            // blocks until all published snapshots are consumed by all stages
+    void report(std::ostream& out);                                                                                          // writes the snapshots published and dropped and the load of every stage
+  private:
+    struct stage
+    {
+      std::string name;                                                                                                      // name in the report
+      std::function<void(const snapshot<SITE,INFO>&)> consume;                                                               // measurement, called with the snapshots in order of publication
+      std::deque<uint8_t> queue;                                                                                             // buffers published but not consumed yet
+      uint64_t consumed = 0;                                                                                                 // number of snapshots consumed
+      double busy = 0;                                                                                                       // seconds spent in consume
+      size_t backlog = 0;                                                                                                    // largest length of the queue
+      std::thread worker;                                                                                                    // consumes the queue
+    };
+    void work(stage& s);                                                                                                     // consumes the queue of the stage until stopped
+    uint32_t volume;                                                                                                         // number of sites per snapshot
+    std::vector<std::unique_ptr<SITE[]>> buffers;                                                                            // preallocated copies of the state
+    std::vector<snapshot<SITE,INFO>> frames;                                                                                 // snapshot held by every buffer
+    std::vector<uint8_t> references;                                                                                         // number of stages that still need every buffer (the publisher counts as one while copying)
+    std::vector<std::unique_ptr<stage>> stages;                                                                              // attached stages
+    uint64_t published;                                                                                                      // number of snapshots handed to the stages
+    uint64_t dropped;                                                                                                        // number of snapshots dropped because no buffer was free
+    bool stopping;                                                                                                           // the workers stop once their queues are empty
+    bool draining;                                                                                                           // drain() waits for the workers
+    std::mutex mutex;                                                                                                        // protects the queues, references, the counters and stopping
+    std::condition_variable changed;                                                                                         // signals published and consumed snapshots and stopping
+};
+
+template <typename SITE, typename INFO>
+snapshot_pipeline<SITE,INFO>::snapshot_pipeline(uint32_t _volume, uint8_t _buffers) : volume(_volume) , frames(_buffers) , references(_buffers,0) , published(0) , dropped(0) , stopping(false) , draining(false)
+{
+  for(uint8_t b = 0; b < _buffers; b++){
+    buffers.emplace_back(new SITE[volume]);
+    frames[b].sites = buffers[b].get();
+  }
+}
+
+template <typename SITE, typename INFO>
+snapshot_pipeline<SITE,INFO>::~snapshot_pipeline()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  for(auto& s : stages) if(s->worker.joinable()) s->worker.join();
+}
+
+template <typename SITE, typename INFO> void
+snapshot_pipeline<SITE,INFO>::attach(std::string name, std::function<void(const snapshot<SITE,INFO>&)> consume)
+{
+  stages.emplace_back(new stage);
+  stages.back()->name = name;
+  stages.back()->consume = std::move(consume);
+  if(!buffers.empty()) stages.back()->worker = std::thread(&snapshot_pipeline::work,this,std::ref(*stages.back()));
+}
+
+template <typename SITE, typename INFO> bool
+snapshot_pipeline<SITE,INFO>::publish(const SITE* state, const INFO& info)
+{
+  if(stages.empty()) return false;
+  if(buffers.empty()){
+    snapshot<SITE,INFO> live{state,info};
+    for(auto& s : stages){
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      s->consume(live);
+      s->busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+      s->consumed++;
+    }
+    published++;
+    return true;
+  }
+  uint8_t b = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while(b < buffers.size() && references[b] > 0) b++;
+    if(b == buffers.size()){
+      dropped++;
+      return false;
+    }
+    references[b] = 1;
+  }
+  // no stage sees the buffer before it is queued
+  std::copy(state,state+volume,buffers[b].get());
+  frames[b].info = info;
+  // only idle workers wait for a snapshot, the others find it when they are done
+  bool idle = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    references[b] = stages.size();
+    for(auto& s : stages){
+      idle = idle || s->queue.empty();
+      s->queue.push_back(b);
+      s->backlog = std::max(s->backlog,s->queue.size());
+    }
+    published++;
+  }
+  if(idle) changed.notify_all();
+  return true;
+}
+
+template <typename SITE, typename INFO> void
+snapshot_pipeline<SITE,INFO>::work(stage& s)
+{
+  metrics_thread activity(s.name);
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true){
+    changed.wait(lock,[&]{ return stopping || !s.queue.empty(); });
+    if(s.queue.empty()) return;
+    uint8_t b = s.queue.front();
+    lock.unlock();
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    activity.busy();
+    s.consume(frames[b]);
+    activity.idle();
+    double busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    lock.lock();
+    s.queue.pop_front();
+    s.busy += busy;
+    s.consumed++;
+    references[b]--;
+    if(draining) changed.notify_all();
+  }
+}
+
+template <typename SITE, typename INFO> void
+snapshot_pipeline<SITE,INFO>::drain()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  draining = true;
+  changed.wait(lock,[this]{ return std::all_of(references.begin(),references.end(),[](uint8_t r){ return r == 0; }); });
+  draining = false;
+}
+
+template <typename SITE, typename INFO> void
+snapshot_pipeline<SITE,INFO>::report(std::ostream& out)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  out << fmt::format("Snapshots: {} published, {} dropped ({} buffers)",published,dropped,buffers.size());
+  for(auto& s : stages) out << fmt::format("; {}: {} consumed, {:.2f} s busy, backlog <= {}",s->name,s->consumed,s->busy,s->backlog);
+  out << "." << std::endl;
+}
+
+#endif
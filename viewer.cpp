@@ -0,0 +1,97 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <dirent.h>
+#include <signal.h>
+#include <fmt/core.h>
+#include <opencv2/opencv.hpp>
+
+#include "live_view.h"
+
+// Watches a running simulation (main built with DISPLAY) through its shared-memory segment /ising_<pid>, without
+// slowing it down: the frame is copied under the seqlock of live_view.h and drawn here. Without a pid, the first
+// segment found in /dev/shm is watched. Keys: ESC ends the current run of the simulation, q closes the viewer.
+
+// returns the pid of the first simulation with a segment in /dev/shm (0: none)
+int32_t find_simulation()
+{
+  int32_t pid = 0;
+  DIR* shm = opendir("/dev/shm");
+  if(shm == nullptr) return 0;
+  while(dirent* entry = readdir(shm)){
+    std::string name = entry->d_name;
+    if(name.rfind("ising_",0) == 0){
+      pid = atoi(name.c_str()+6);
+      if(pid > 0 && kill(pid,0) == 0) break;
+      pid = 0;
+    }
+  }
+  closedir(shm);
+  return pid;
+}
+
+int main(int argc, char *argv[]){
+  int32_t pid = (argc > 1) ? atoi(argv[1]) : find_simulation();
+  if(pid <= 0){
+    std::cout << "Usage:\n\t" << argv[0] << " [pid of the simulation]\nNo running simulation found." << std::endl;
+    return 1;
+  }
+  std::string name = live_view::segment(pid);
+  int fd = shm_open(name.c_str(),O_RDWR,0);
+  struct stat status;
+  if(fd < 0 || fstat(fd,&status) != 0 || (size_t) status.st_size < sizeof(live_view_header)){
+    std::cout << "Cannot open the shared-memory segment " << name << "." << std::endl;
+    return 1;
+  }
+  void* address = mmap(nullptr,status.st_size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if(address == MAP_FAILED){
+    std::cout << "Cannot map the shared-memory segment " << name << "." << std::endl;
+    return 1;
+  }
+  live_view_header* header = (live_view_header*) address;
+  const uint8_t* pixels = (const uint8_t*) address + sizeof(live_view_header);
+  while(header->magic != live_view_magic) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  std::vector<uint8_t> copy((size_t) header->capacity*header->capacity);
+  cv::Mat bgr;
+  cv::namedWindow(name,cv::WINDOW_NORMAL);
+  uint64_t shown = 0;
+  int key = 0;
+  while(key != 'q' && kill(pid,0) == 0)
+  {
+    uint64_t before = header->sequence.load(std::memory_order_acquire);
+    if(before == shown || before % 2 == 1){
+      key = cv::waitKey(20);
+      if(key == 27) header->stop = 1;
+      continue;
+    }
+    // the copy is torn if the simulation wrote meanwhile, then it is discarded and retried
+    uint16_t length = std::min(header->length,header->capacity);
+    double sweeps = header->sweeps;
+    double magnetization = header->magnetization;
+    double energy = header->energy;
+    double temperature = header->temperature;
+    std::copy(pixels,pixels+(size_t) length*length,copy.begin());
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(header->sequence.load(std::memory_order_relaxed) != before || length == 0) continue;
+    shown = before;
+    uint16_t bar = std::max(length/15,20);
+    bgr.create(length+bar,length,CV_8UC3);
+    for(uint16_t i = 0; i < length; i++){
+      cv::Vec3b* pixel = bgr.ptr<cv::Vec3b>(i);
+      for(uint16_t j = 0; j < length; j++) pixel[j] = cv::Vec3b(copy[(uint32_t) i*length+j],copy[(uint32_t) i*length+j],copy[(uint32_t) i*length+j]);
+    }
+    bgr.rowRange(length,length+bar).setTo(cv::Scalar(0,0,0));
+    cv::putText(bgr,fmt::format("T = {:.4f}  sweeps = {:.0f}  m = {:+.4f}  e = {:.4f}",temperature,sweeps,magnetization,energy),cv::Point(5,length+0.7*bar),cv::FONT_HERSHEY_DUPLEX,bar/40.,cv::Scalar(255,255,255));
+    cv::imshow(name,bgr);
+    key = cv::waitKey(1);
+    if(key == 27) header->stop = 1;
+  }
+  cv::destroyWindow(name);
+  munmap(address,status.st_size);
+  return 0;
+}
@@ -0,0 +1,335 @@
+#ifndef WANG_LANDAU_H
+#define WANG_LANDAU_H
+
+#include <fmt/core.h>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <math.h>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include "configuration.h"
+#include "jobs.h"
+#include "shutdown.h"
+
+// Density of states g(E) of the zero-field Ising model by replica-exchange Wang-Landau sampling. The energy range is
+// split into overlapping windows, one walker (a configuration without window, video and datafile) per window. A walker
+// flips random spins with the acceptance min(1, g(E)/g(E')) restricted to its window and raises ln g(E) of the current
+// energy by ln f; once the histogram of a window is flat, ln f is halved. All walkers advance concurrently for a number
+// of sweeps, then neighbouring windows exchange their walkers if both energies lie in the overlap, with the probability
+// that keeps both random walks in detailed balance. The windows are joined where the slopes of their ln g agree best.
+// A multicanonical production run with the converged weights then samples the microcanonical averages of the
+// magnetization, so that the canonical averages follow at every temperature by reweighting.
+// The energy E = -sum s_i s_j is an integer that changes by even amounts; the bins are spaced by 2.
+
+// canonical averages per spin at one temperature, reweighted from the density of states
+struct canonical_averages
+{
+  double magnetization;                                                                                                      // average abolute value of the magnetization
+  double magnetization_squared;                                                                                              // average square of the magnetization
+  double magnetization_fourth;                                                                                               // average fourth power of the magnetization
+  double energy;                                                                                                             // average energy
+  double energy_squared;                                                                                                     // average square of the energy
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT = row_major<ARRAY_LEN>, typename FIELDS = computed_fields<LAYOUT>>
+class wang_landau
+{
+  static_assert(!FIELDS::disordered, "the Wang-Landau engine is only implemented for the clean Ising model");
+  public:
+    wang_landau(uint16_t _windows = std::thread::hardware_concurrency(), double lower = -(double) LAYOUT::dimension, double upper = 0); // constructor for the energy range [lower,upper] per site, split into the given number of windows
+    void run(double final_ln_f = 1e-6, uint32_t production_sweeps = 100000, uint32_t exchange_sweeps = 100);                // estimates g(E) down to final_ln_f, then samples the magnetization in a multicanonical run
+    canonical_averages canonical(float beta) const;                                                                          // returns the canonical averages at beta (concurrent calls are safe)
+    void write(std::string filename);                                                                                        // writes e, ln g(e) and the microcanonical averages of the magnetization per bin
+    bool interrupted;                                                                                                        // run() was stopped by a signal before g(E) converged or the production run ended (see shutdown.h)
+  private:
+    static constexpr int32_t bonds = LAYOUT::coordination * LAYOUT::volume / 2;                                             // number of bonds, E lies in [-bonds,bonds]
+    struct window
+    {
+      int32_t first;                                                                                                         // lowest bin
+      int32_t last;                                                                                                          // highest bin
+      double ln_f;                                                                                                           // modification factor
+      std::vector<double> ln_g;                                                                                              // estimate of ln g per bin
+      std::vector<uint64_t> histogram;                                                                                       // visits per bin since the last reduction of ln f
+      std::vector<bool> visited;                                                                                             // the bin has been visited at all
+      bool flat();                                                                                                           // returns whether the histogram of the visited bins is flat
+    };
+    struct walker : configuration<ARRAY_LEN,LAYOUT,FIELDS>
+    {
+      walker();                                                                                                              // constructor, random configuration
+      int32_t energy_change(uint32_t s);                                                                                     // returns the change of the bin upon flipping the spin at s
+      void enter(const window& w);                                                                                           // flips spins until the energy lies in the window
+      int32_t bin;                                                                                                           // current bin, (E + bonds) / 2
+      uint16_t served;                                                                                                       // index of the window served
+      std::vector<double> count;                                                                                             // production samples per bin
+      std::vector<double> magnetization;                                                                                     // sum of |m| per bin
+      std::vector<double> magnetization_squared;                                                                             // sum of m^2 per bin
+      std::vector<double> magnetization_fourth;                                                                              // sum of m^4 per bin
+      using configuration<ARRAY_LEN,LAYOUT,FIELDS>::rng;
+      using configuration<ARRAY_LEN,LAYOUT,FIELDS>::site_distribution;
+      using configuration<ARRAY_LEN,LAYOUT,FIELDS>::real_distribution;
+      using configuration<ARRAY_LEN,LAYOUT,FIELDS>::invert_spin;
+      using configuration<ARRAY_LEN,LAYOUT,FIELDS>::local_state;
+    };
+    void walk(walker& w, uint32_t sweeps, bool production);                                                                 // advances the walker in its window, updating ln g or sampling the magnetization
+    void exchange(uint8_t parity);                                                                                          // proposes to exchange the walkers of the windows (2k+parity,2k+parity+1)
+    void join();                                                                                                             // joins the windows into ln_g and merges the samples of the walkers
+    std::vector<window> windows;                                                                                             // energy windows, in increasing order
+    std::vector<std::unique_ptr<walker>> walkers;                                                                            // walkers, walkers[k] started in window k
+    std::vector<uint16_t> walker_of;                                                                                         // index of the walker serving each window
+    std::mt19937 rng;                                                                                                        // random numbers of the exchanges
+    std::uniform_real_distribution<double> real_distribution;                                                                // converts the 32-bit random numbers to real interval
+    std::vector<double> ln_g;                                                                                                // joined ln g per bin (-infinity if never visited)
+    std::vector<double> count;                                                                                               // production samples per bin, all walkers
+    std::vector<double> magnetization;                                                                                       // microcanonical average of |m| per bin
+    std::vector<double> magnetization_squared;                                                                               // microcanonical average of m^2 per bin
+    std::vector<double> magnetization_fourth;                                                                                // microcanonical average of m^4 per bin
+};
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> bool
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::window::flat()
+{
+  uint64_t minimum = ~0ull;
+  double mean = 0;
+  uint32_t bins = 0;
+  for(size_t b = 0; b < histogram.size(); b++){
+    if(!visited[b]) continue;
+    minimum = std::min(minimum,histogram[b]);
+    mean += histogram[b];
+    bins++;
+  }
+  return bins > 1 && minimum >= 0.8 * mean / bins;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS>
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::walker::walker() : configuration<ARRAY_LEN,LAYOUT,FIELDS>("",1) , served(0) , count(bonds+1,0) , magnetization(bonds+1,0) , magnetization_squared(bonds+1,0) , magnetization_fourth(bonds+1,0)
+{
+  int64_t energy = 0;
+  for(uint32_t s = 0; s < LAYOUT::volume; s++) energy += energy_change(s);
+  // every bond enters twice, and a flip changes the energy by -2 s_i h_i
+  bin = (-energy / 2 + bonds) / 2;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> int32_t
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::walker::energy_change(uint32_t s)
+{
+  uint8_t state = local_state(s);
+  int32_t field = 2 * (state & sum_mask) - LAYOUT::coordination;
+  return (state >> spin_bit) ? field : -field;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::walker::enter(const window& w)
+{
+  // greedy: accept every flip that does not move the energy away from the window
+  auto distance = [&](int32_t b){ return (b < w.first) ? w.first - b : (b > w.last) ? b - w.last : 0; };
+  while(distance(bin) > 0){
+    uint32_t s = site_distribution(rng);
+    int32_t next = bin + energy_change(s);
+    if(distance(next) <= distance(bin)){
+      invert_spin(s);
+      bin = next;
+    }
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS>
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::wang_landau(uint16_t _windows, double lower, double upper) : rng(std::random_device{}()) , real_distribution{0.0,1.0}
+{
+  interrupted = false;
+  uint16_t n = std::max<uint16_t>(_windows,1);
+  int32_t first = std::max<int32_t>(0,floor((lower * LAYOUT::volume + bonds) / 2));
+  int32_t last = std::min<int32_t>(bonds,ceil((upper * LAYOUT::volume + bonds) / 2));
+  // windows overlapping by 75%, so that exchanges are accepted frequently
+  double width = (last - first) / (1 + 0.25 * (n - 1));
+  for(uint16_t k = 0; k < n; k++){
+    window w;
+    w.first = first + floor(0.25 * width * k);
+    w.last = (k == n - 1) ? last : first + ceil(0.25 * width * k + width);
+    w.ln_f = 1;
+    w.ln_g.assign(w.last - w.first + 1,0);
+    w.histogram.assign(w.last - w.first + 1,0);
+    w.visited.assign(w.last - w.first + 1,false);
+    windows.push_back(w);
+    walkers.emplace_back(new walker());
+    walkers.back()->served = k;
+    walkers.back()->enter(windows[k]);
+    walker_of.push_back(k);
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::walk(walker& w, uint32_t sweeps, bool production)
+{
+  window& win = windows[w.served];
+  for(uint32_t sweep = 0; sweep < sweeps; sweep++){
+    for(uint32_t n = 0; n < LAYOUT::volume; n++){
+      uint32_t s = w.site_distribution(w.rng);
+      int32_t next = w.bin + w.energy_change(s);
+      if(next >= win.first && next <= win.last){
+        double difference = win.ln_g[w.bin - win.first] - win.ln_g[next - win.first];
+        if(difference >= 0 || w.real_distribution(w.rng) < exp(difference)){
+          w.invert_spin(s);
+          w.bin = next;
+        }
+      }
+      if(!production){
+        win.ln_g[w.bin - win.first] += win.ln_f;
+        win.histogram[w.bin - win.first]++;
+        win.visited[w.bin - win.first] = true;
+      }
+    }
+    if(production){
+      double m = w.get_magnetization();
+      w.count[w.bin]++;
+      w.magnetization[w.bin] += std::abs(m);
+      w.magnetization_squared[w.bin] += m*m;
+      w.magnetization_fourth[w.bin] += m*m*m*m;
+    }
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::exchange(uint8_t parity)
+{
+  for(size_t k = parity; k + 1 < windows.size(); k += 2){
+    walker& a = *walkers[walker_of[k]];
+    walker& b = *walkers[walker_of[k+1]];
+    const window& lower = windows[k];
+    const window& upper = windows[k+1];
+    if(a.bin < upper.first || a.bin > upper.last || b.bin < lower.first || b.bin > lower.last) continue;
+    double ln_p = lower.ln_g[a.bin - lower.first] + upper.ln_g[b.bin - upper.first] - lower.ln_g[b.bin - lower.first] - upper.ln_g[a.bin - upper.first];
+    if(ln_p >= 0 || real_distribution(rng) < exp(ln_p)){
+      std::swap(a.served,b.served);
+      std::swap(walker_of[k],walker_of[k+1]);
+    }
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::run(double final_ln_f, uint32_t production_sweeps, uint32_t exchange_sweeps)
+{
+  job_pool pool(windows.size());
+  auto round = [&](bool production){
+    for(auto& w : walkers) pool.submit([this,&w,exchange_sweeps,production]{ walk(*w,exchange_sweeps,production); });
+    pool.wait();
+    exchange(0);
+    exchange(1);
+  };
+  uint64_t rounds = 0;
+  while(true){
+    // a round takes exchange_sweeps sweeps
+    if(shutdown_requested()){
+      interrupted = true;
+      return;
+    }
+    round(false);
+    rounds++;
+    bool converged = true;
+    for(window& w : windows){
+      if(w.ln_f >= final_ln_f && w.flat()){
+        w.ln_f /= 2;
+        std::fill(w.histogram.begin(),w.histogram.end(),0);
+      }
+      converged = converged && w.ln_f < final_ln_f;
+    }
+    if(converged) break;
+  }
+  std::cout << "Wang-Landau converged after " << rounds*exchange_sweeps << " sweeps per walker." << std::endl;
+  for(uint32_t sweeps = 0; sweeps < production_sweeps && !interrupted; sweeps += exchange_sweeps){
+    round(true);
+    interrupted = shutdown_requested();
+  }
+  join();
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::join()
+{
+  ln_g.assign(bonds+1,-INFINITY);
+  const window& base = windows[0];
+  for(int32_t b = base.first; b <= base.last; b++) if(base.visited[b - base.first]) ln_g[b] = base.ln_g[b - base.first];
+  for(size_t k = 1; k < windows.size(); k++){
+    const window& w = windows[k];
+    // the junction is the bin of the overlap where the slopes of ln g (to the next bin visited in both) agree best
+    std::vector<int32_t> common;
+    for(int32_t b = w.first; b <= windows[k-1].last; b++) if(std::isfinite(ln_g[b]) && w.visited[b - w.first]) common.push_back(b);
+    if(common.empty()) continue;
+    int32_t junction = common[0];
+    double best = INFINITY;
+    for(size_t i = 0; i + 1 < common.size(); i++){
+      double mismatch = std::abs((ln_g[common[i+1]] - ln_g[common[i]]) - (w.ln_g[common[i+1] - w.first] - w.ln_g[common[i] - w.first]));
+      if(mismatch < best){
+        best = mismatch;
+        junction = common[i];
+      }
+    }
+    double shift = ln_g[junction] - w.ln_g[junction - w.first];
+    for(int32_t b = junction; b <= w.last; b++) ln_g[b] = w.visited[b - w.first] ? w.ln_g[b - w.first] + shift : -INFINITY;
+  }
+  // two ground states
+  auto ground = std::find_if(ln_g.begin(),ln_g.end(),[](double x){ return std::isfinite(x); });
+  double shift = (ground == ln_g.end()) ? 0 : log(2.) - *ground;
+  for(double& x : ln_g) x += shift;
+  count.assign(bonds+1,0);
+  magnetization.assign(bonds+1,0);
+  magnetization_squared.assign(bonds+1,0);
+  magnetization_fourth.assign(bonds+1,0);
+  for(auto& w : walkers){
+    for(int32_t b = 0; b <= bonds; b++){
+      count[b] += w->count[b];
+      magnetization[b] += w->magnetization[b];
+      magnetization_squared[b] += w->magnetization_squared[b];
+      magnetization_fourth[b] += w->magnetization_fourth[b];
+    }
+  }
+  for(int32_t b = 0; b <= bonds; b++){
+    if(count[b] == 0) continue;
+    magnetization[b] /= count[b];
+    magnetization_squared[b] /= count[b];
+    magnetization_fourth[b] /= count[b];
+  }
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> canonical_averages
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::canonical(float beta) const
+{
+  double maximum = -INFINITY;
+  for(int32_t b = 0; b <= bonds; b++) maximum = std::max(maximum,ln_g[b] + beta * (bonds - 2. * b));
+  double z = 0;
+  double z_sampled = 0;
+  canonical_averages mean = {0,0,0,0,0};
+  for(int32_t b = 0; b <= bonds; b++){
+    if(!std::isfinite(ln_g[b])) continue;
+    double e = (2. * b - bonds) / LAYOUT::volume;
+    double weight = exp(ln_g[b] - beta * e * LAYOUT::volume - maximum);
+    z += weight;
+    mean.energy += weight * e;
+    mean.energy_squared += weight * e * e;
+    if(count[b] == 0) continue;
+    z_sampled += weight;
+    mean.magnetization += weight * magnetization[b];
+    mean.magnetization_squared += weight * magnetization_squared[b];
+    mean.magnetization_fourth += weight * magnetization_fourth[b];
+  }
+  mean.energy /= z;
+  mean.energy_squared /= z;
+  mean.magnetization /= z_sampled;
+  mean.magnetization_squared /= z_sampled;
+  mean.magnetization_fourth /= z_sampled;
+  return mean;
+}
+
+template <uint16_t ARRAY_LEN, typename LAYOUT, typename FIELDS> void
+wang_landau<ARRAY_LEN,LAYOUT,FIELDS>::write(std::string filename)
+{
+  std::ofstream out(filename,std::ofstream::out);
+  out << "e\tln_g\tsamples\tmag\tmag2\tmag4\n";
+  for(int32_t b = 0; b <= bonds; b++){
+    if(std::isfinite(ln_g[b])) out << (2. * b - bonds) / LAYOUT::volume << "\t" << ln_g[b] << "\t" << count[b] << "\t" << magnetization[b] << "\t" << magnetization_squared[b] << "\t" << magnetization_fourth[b] << std::endl;
+  }
+}
+
+#endif